@@ -0,0 +1,161 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <clientversion.h>
+#include <coins.h>
+#include <random.h>
+#include <streams.h>
+#include <util.h>
+
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <vector>
+
+// Backing view that keeps coins serialized, so that cache misses pay for a
+// lookup and a deserialization as they would against the coins database.
+class CCoinsViewSerialized : public CCoinsView
+{
+    std::map<COutPoint, std::vector<char>> mapCoins;
+    uint256 hashBestBlock;
+
+public:
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override
+    {
+        auto it = mapCoins.find(outpoint);
+        if (it == mapCoins.end()) {
+            return false;
+        }
+        CDataStream ss(it->second, SER_DISK, CLIENT_VERSION);
+        ss >> coin;
+        return true;
+    }
+
+    uint256 GetBestBlock() const override { return hashBestBlock; }
+
+    bool BatchWrite(CCoinsMap &mapWrite, const uint256 &hashBlock) override
+    {
+        for (CCoinsMap::iterator it = mapWrite.begin(); it != mapWrite.end(); it = mapWrite.erase(it)) {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+                continue;
+            }
+            if (it->second.coin.IsSpent()) {
+                mapCoins.erase(it->first);
+            } else {
+                CDataStream ss(SER_DISK, CLIENT_VERSION);
+                ss << it->second.coin;
+                mapCoins[it->first].assign(ss.begin(), ss.end());
+            }
+        }
+        hashBestBlock = hashBlock;
+        return true;
+    }
+};
+
+// Simulates a block's worth of coins cache activity followed by a flush:
+// look up part of a working set of coins, replace some of them, then flush
+// either by dropping the whole cache or by writing only the modified entries.
+static void CoinsCacheFlushCycles(benchmark::State& state, bool fErase)
+{
+    static const size_t WORKING_SET = 10000;
+    static const size_t ACCESSES_PER_CYCLE = 2000;
+    static const size_t SPENDS_PER_CYCLE = 100;
+
+    FastRandomContext rng(true);
+    CCoinsViewSerialized base;
+    CCoinsViewCache cache(&base);
+
+    Coin coin;
+    coin.out.nValue = 50 * COIN;
+    coin.out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG;
+    coin.nHeight = 1;
+    std::vector<COutPoint> vOutPoints;
+    for (size_t i = 0; i < WORKING_SET; i++) {
+        vOutPoints.emplace_back(rng.rand256(), 0);
+        cache.AddCoin(vOutPoints.back(), Coin(coin), false);
+    }
+    cache.Flush();
+
+    size_t nNext = 0;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < ACCESSES_PER_CYCLE; i++) {
+            const COutPoint& outpoint = vOutPoints[(nNext + i) % WORKING_SET];
+            assert(cache.AccessCoin(outpoint).out.nValue == coin.out.nValue);
+        }
+        for (size_t i = 0; i < SPENDS_PER_CYCLE; i++) {
+            COutPoint& outpoint = vOutPoints[rng.randrange(WORKING_SET)];
+            cache.SpendCoin(outpoint);
+            outpoint = COutPoint(rng.rand256(), 0);
+            cache.AddCoin(outpoint, Coin(coin), false);
+        }
+        nNext += ACCESSES_PER_CYCLE / 4;
+        cache.SetBestBlock(rng.rand256());
+        cache.Flush(fErase);
+    }
+}
+
+static void CoinsCacheFlushErase(benchmark::State& state)
+{
+    CoinsCacheFlushCycles(state, true);
+}
+
+static void CoinsCacheFlushRetain(benchmark::State& state)
+{
+    CoinsCacheFlushCycles(state, false);
+}
+
+BENCHMARK(CoinsCacheFlushErase, 550);
+BENCHMARK(CoinsCacheFlushRetain, 1200);
+
+// Looks up a set of coins that are not cached yet, split among a number of
+// threads, in a cache with the given number of shards.
+static void CoinsCacheLookups(benchmark::State& state, int nThreads, size_t nShards)
+{
+    static const size_t COINS = 20000;
+
+    FastRandomContext rng(true);
+    CCoinsViewSerialized base;
+    Coin coin;
+    coin.out.nValue = 50 * COIN;
+    coin.out.scriptPubKey = CScript() << OP_0 << std::vector<unsigned char>(20, 0);
+    coin.nHeight = 1;
+    std::vector<COutPoint> vOutPoints;
+    {
+        CCoinsViewCache writer(&base);
+        for (size_t i = 0; i < COINS; i++) {
+            vOutPoints.emplace_back(rng.rand256(), 0);
+            writer.AddCoin(vOutPoints.back(), Coin(coin), false);
+        }
+        writer.Flush();
+    }
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&base, nShards);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nThreads; t++) {
+            threads.emplace_back([&, t] {
+                for (size_t i = t; i < vOutPoints.size(); i += nThreads) {
+                    assert(cache.HaveCoin(vOutPoints[i]));
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+static void CoinsCacheLookupsSingleThread(benchmark::State& state)
+{
+    CoinsCacheLookups(state, 1, 1);
+}
+
+static void CoinsCacheLookupsSharded(benchmark::State& state)
+{
+    CoinsCacheLookups(state, std::max(2, GetNumCores()), 16);
+}
+
+BENCHMARK(CoinsCacheLookupsSingleThread, 50);
+BENCHMARK(CoinsCacheLookupsSharded, 50);
@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 
 #include <chainparams.h>
+#include <consensus/merkle.h>
 #include <validation.h>
 #include <streams.h>
 #include <consensus/validation.h>
@@ -52,5 +53,22 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+static void BlockMerkleRootTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        assert(BlockMerkleRoot(block, &mutated) == block.hashMerkleRoot);
+        assert(!mutated);
+        BlockWitnessMerkleRoot(block, &mutated);
+    }
+}
+
 BENCHMARK(DeserializeBlockTest, 130);
 BENCHMARK(DeserializeAndCheckBlockTest, 160);
+BENCHMARK(BlockMerkleRootTest, 1500);
@@ -0,0 +1,96 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <dbwrapper.h>
+#include <random.h>
+#include <uint256.h>
+
+#include <memory>
+#include <vector>
+
+// Compares the LevelDB profiles of DBProfile on a database of 100000 keys
+// shaped like txindex entries. The database is kept in memory, so this
+// measures the CPU cost of filters and block decoding, and not the disk
+// reads that the filters and smaller tables save.
+
+static const int NUM_KEYS = 100000;
+
+static std::unique_ptr<CDBWrapper> MakeDB(const DBProfile& profile, FastRandomContext& rng, std::vector<uint256>& keys)
+{
+    std::unique_ptr<CDBWrapper> dbw(new CDBWrapper(fs::temp_directory_path() / fs::unique_path(), 1 << 20, true, false, false, profile));
+    CDBBatch batch(*dbw);
+    for (int i = 0; i < NUM_KEYS; i++) {
+        keys.push_back(rng.rand256());
+        // A file number, a position and an offset, as in a CDiskTxPos.
+        batch.Write(std::make_pair('t', keys.back()), std::vector<uint32_t>{(uint32_t)(i / 1000), (uint32_t)rng.randrange(128 << 20), (uint32_t)rng.randrange(1 << 20)});
+    }
+    dbw->WriteBatch(batch);
+    dbw->CompactRange(std::make_pair('t', uint256()), std::make_pair('u', uint256()));
+    return dbw;
+}
+
+static void DBLookups(benchmark::State& state, const DBProfile& profile)
+{
+    FastRandomContext rng(true);
+    std::vector<uint256> keys;
+    std::unique_ptr<CDBWrapper> dbw = MakeDB(profile, rng, keys);
+
+    // Half the lookups are for keys that are not in the database.
+    std::vector<uint32_t> value;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100; i++) {
+            dbw->Read(std::make_pair('t', keys[rng.randrange(NUM_KEYS)]), value);
+            dbw->Read(std::make_pair('t', rng.rand256()), value);
+        }
+    }
+}
+
+static void DBIteration(benchmark::State& state, const DBProfile& profile)
+{
+    FastRandomContext rng(true);
+    std::vector<uint256> keys;
+    std::unique_ptr<CDBWrapper> dbw = MakeDB(profile, rng, keys);
+
+    std::pair<char, uint256> key;
+    std::vector<uint32_t> value;
+    while (state.KeepRunning()) {
+        std::unique_ptr<CDBIterator> pcursor(dbw->NewIterator());
+        for (pcursor->Seek(std::make_pair('t', uint256())); pcursor->Valid(); pcursor->Next()) {
+            pcursor->GetKey(key);
+            pcursor->GetValue(value);
+        }
+    }
+}
+
+static DBProfile DefaultProfile()
+{
+    return DBProfile();
+}
+
+static DBProfile NoBloomProfile()
+{
+    DBProfile profile;
+    profile.bloom_bits = 0;
+    return profile;
+}
+
+static DBProfile LargeBlocksProfile()
+{
+    DBProfile profile;
+    profile.block_size = 64 << 10;
+    return profile;
+}
+
+static void DBLookupsDefault(benchmark::State& state) { DBLookups(state, DefaultProfile()); }
+static void DBLookupsNoBloom(benchmark::State& state) { DBLookups(state, NoBloomProfile()); }
+static void DBLookupsLargeBlocks(benchmark::State& state) { DBLookups(state, LargeBlocksProfile()); }
+static void DBIterationDefault(benchmark::State& state) { DBIteration(state, DefaultProfile()); }
+static void DBIterationLargeBlocks(benchmark::State& state) { DBIteration(state, LargeBlocksProfile()); }
+
+BENCHMARK(DBLookupsDefault, 200);
+BENCHMARK(DBLookupsNoBloom, 200);
+BENCHMARK(DBLookupsLargeBlocks, 200);
+BENCHMARK(DBIterationDefault, 5);
+BENCHMARK(DBIterationLargeBlocks, 5);
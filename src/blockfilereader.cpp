@@ -0,0 +1,138 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilereader.h>
+
+#include <compat.h>
+#include <tinyformat.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <ios>
+#include <stdio.h>
+#include <string.h>
+
+BlockFileReader g_blockfilereader(MAX_OPEN_BLOCK_FILES);
+
+struct BlockFileReader::File
+{
+    FILE* file;
+
+    explicit File(FILE* fileIn) : file(fileIn) {}
+    ~File() { fclose(file); }
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+};
+
+BlockFileReader::BlockFileReader(size_t max_files) : m_max_files(std::max<size_t>(1, max_files)) {}
+
+BlockFileReader::~BlockFileReader()
+{
+    Clear();
+}
+
+std::shared_ptr<BlockFileReader::File> BlockFileReader::Open(const fs::path& path)
+{
+    LOCK(cs);
+    auto it = m_file_map.find(path);
+    if (it != m_file_map.end()) {
+        m_files.splice(m_files.begin(), m_files, it->second);
+        return it->second->second;
+    }
+
+    FILE* file = fsbridge::fopen(path, "rb");
+    if (!file) {
+        throw std::ios_base::failure(strprintf("BlockFileReader: unable to open file %s", path.string()));
+    }
+    std::shared_ptr<File> ret = std::make_shared<File>(file);
+    if (m_files.size() >= m_max_files) {
+        // A thread still reading from the evicted file keeps it open until it is done.
+        m_file_map.erase(m_files.back().first);
+        m_files.pop_back();
+    }
+    m_files.emplace_front(path, ret);
+    m_file_map.emplace(path, m_files.begin());
+    return ret;
+}
+
+size_t BlockFileReader::Read(const fs::path& path, uint64_t nPos, char* pch, size_t nSize)
+{
+    std::shared_ptr<File> file = Open(path);
+    size_t nRead = 0;
+    while (nRead < nSize) {
+#ifdef WIN32
+        HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(file->file));
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)(nPos + nRead);
+        overlapped.OffsetHigh = (DWORD)((nPos + nRead) >> 32);
+        DWORD nNow = 0;
+        if (!ReadFile(hFile, pch + nRead, (DWORD)std::min<size_t>(nSize - nRead, 1 << 30), &nNow, &overlapped)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) break;
+            throw std::ios_base::failure(strprintf("BlockFileReader: read failed for %s", path.string()));
+        }
+#else
+        ssize_t nNow = pread(fileno(file->file), pch + nRead, nSize - nRead, nPos + nRead);
+        if (nNow < 0) {
+            if (errno == EINTR) continue;
+            throw std::ios_base::failure(strprintf("BlockFileReader: read failed for %s: %s", path.string(), strerror(errno)));
+        }
+#endif
+        if (nNow == 0) break;
+        nRead += nNow;
+    }
+    return nRead;
+}
+
+void BlockFileReader::Close(const fs::path& path)
+{
+    LOCK(cs);
+    auto it = m_file_map.find(path);
+    if (it != m_file_map.end()) {
+        m_files.erase(it->second);
+        m_file_map.erase(it);
+    }
+}
+
+void BlockFileReader::Clear()
+{
+    LOCK(cs);
+    m_file_map.clear();
+    m_files.clear();
+}
+
+void BlockFileStream::Fill(size_t nMinSize)
+{
+    m_buf.resize(std::max(nMinSize, m_read_size));
+    const size_t nRead = m_reader.Read(m_path, m_pos, m_buf.data(), m_buf.size());
+    m_buf.resize(nRead);
+    m_buf_pos = 0;
+    m_pos += nRead;
+    m_read_size = std::min(m_read_size * 2, MAX_READ_SIZE);
+    if (nRead == 0) {
+        throw std::ios_base::failure("BlockFileStream::read: end of file");
+    }
+}
+
+void BlockFileStream::read(char* pch, size_t nSize)
+{
+    while (nSize > 0) {
+        if (m_buf_pos == m_buf.size()) {
+            Fill(nSize);
+        }
+        const size_t nNow = std::min(nSize, m_buf.size() - m_buf_pos);
+        memcpy(pch, m_buf.data() + m_buf_pos, nNow);
+        m_buf_pos += nNow;
+        pch += nNow;
+        nSize -= nNow;
+    }
+}
+
+void BlockFileStream::ignore(size_t nSize)
+{
+    const size_t nNow = std::min(nSize, m_buf.size() - m_buf_pos);
+    m_buf_pos += nNow;
+    // Skip the rest without reading it.
+    m_pos += nSize - nNow;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEREADER_H
+#define BITCOIN_BLOCKFILEREADER_H
+
+#include <fs.h>
+#include <serialize.h>
+#include <sync.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** Number of block and undo files BlockFileReader keeps open. */
+static const size_t MAX_OPEN_BLOCK_FILES = 16;
+
+/**
+ * Reads block and undo files without going through stdio.
+ *
+ * The most recently used files are kept open between reads, and are read
+ * with pread(), which does not use or move a file position. Any number of
+ * threads can read at once, from the same file or from different ones.
+ * Files must be closed here before they are deleted, or reads keep seeing
+ * their old contents.
+ */
+class BlockFileReader
+{
+private:
+    struct File;
+    typedef std::list<std::pair<fs::path, std::shared_ptr<File>>> FileList;
+
+    const size_t m_max_files;
+
+    CCriticalSection cs;
+    //! Open files, most recently used first
+    FileList m_files;
+    std::map<fs::path, FileList::iterator> m_file_map;
+
+    std::shared_ptr<File> Open(const fs::path& path);
+
+public:
+    explicit BlockFileReader(size_t max_files);
+    ~BlockFileReader();
+
+    /**
+     * Read up to nSize bytes at position nPos of a file. Returns the number
+     * of bytes read, which is less than nSize only at the end of the file.
+     * Throws std::ios_base::failure if the file cannot be opened or read.
+     */
+    size_t Read(const fs::path& path, uint64_t nPos, char* pch, size_t nSize);
+
+    /** Close a file if it is open. Reads that are in progress finish first. */
+    void Close(const fs::path& path);
+
+    /** Close all files. */
+    void Clear();
+};
+
+/** The reader for the block and undo files of the node. */
+extern BlockFileReader g_blockfilereader;
+
+/**
+ * A stream that deserializes from a file through a BlockFileReader, starting
+ * at a given position. Data is read ahead in chunks that grow as more of the
+ * file is read, so small objects take a single read and large ones few.
+ */
+class BlockFileStream
+{
+private:
+    static const size_t MIN_READ_SIZE = 4096;
+    static const size_t MAX_READ_SIZE = 1 << 20;
+
+    BlockFileReader& m_reader;
+    const fs::path m_path;
+    const int nType;
+    const int nVersion;
+    //! Position in the file of the end of the buffer
+    uint64_t m_pos;
+    std::vector<char> m_buf;
+    size_t m_buf_pos = 0;
+    size_t m_read_size = MIN_READ_SIZE;
+
+    /** Replace the buffer with the next chunk of the file, of at least nMinSize bytes if possible. */
+    void Fill(size_t nMinSize);
+
+public:
+    BlockFileStream(BlockFileReader& reader, const fs::path& path, uint64_t nPos, int nTypeIn, int nVersionIn)
+        : m_reader(reader), m_path(path), nType(nTypeIn), nVersion(nVersionIn), m_pos(nPos) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    void read(char* pch, size_t nSize);
+    void ignore(size_t nSize);
+
+    template<typename T>
+    BlockFileStream& operator>>(T&& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILEREADER_H
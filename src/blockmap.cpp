@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockmap.h>
+
+#include <assert.h>
+#include <limits>
+
+size_t BlockMap::FindSlot(const uint256& hash) const
+{
+    const uint64_t nCheapHash = hash.GetCheapHash();
+    const uint32_t nTag = nCheapHash >> 32;
+    const size_t nMask = m_slots.size() - 1;
+    // Linear probing; the table always has empty slots, so this terminates.
+    for (size_t nSlot = nCheapHash & nMask; ; nSlot = (nSlot + 1) & nMask) {
+        const Slot& slot = m_slots[nSlot];
+        if (slot.nPos == 0 || (slot.nTag == nTag && GetEntry(slot.nPos - 1).hash == hash)) {
+            return nSlot;
+        }
+    }
+}
+
+void BlockMap::Rehash(size_t nSlots)
+{
+    std::vector<Slot> slots(nSlots, Slot{0, 0});
+    m_slots.swap(slots);
+    for (size_t nPos = 0; nPos < m_size; nPos++) {
+        const uint256& hash = GetEntry(nPos).hash;
+        m_slots[FindSlot(hash)] = Slot{static_cast<uint32_t>(hash.GetCheapHash() >> 32), static_cast<uint32_t>(nPos + 1)};
+    }
+}
+
+BlockMap::const_iterator BlockMap::find(const uint256& hash) const
+{
+    if (m_slots.empty()) {
+        return end();
+    }
+    const Slot& slot = m_slots[FindSlot(hash)];
+    return slot.nPos != 0 ? const_iterator(this, slot.nPos - 1) : end();
+}
+
+CBlockIndex* BlockMap::operator[](const uint256& hash) const
+{
+    const_iterator it = find(hash);
+    return it != end() ? it->second : nullptr;
+}
+
+void BlockMap::reserve(size_t n)
+{
+    assert(n < std::numeric_limits<uint32_t>::max());
+    m_chunks.reserve((n + CHUNK_SIZE - 1) >> CHUNK_BITS);
+    size_t nSlots = m_slots.empty() ? 16 : m_slots.size();
+    while (n * 4 > nSlots * 3) {
+        nSlots *= 2;
+    }
+    if (nSlots != m_slots.size()) {
+        Rehash(nSlots);
+    }
+}
+
+void BlockMap::clear()
+{
+    m_chunks.clear();
+    m_slots.clear();
+    m_size = 0;
+}
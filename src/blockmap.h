@@ -0,0 +1,138 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKMAP_H
+#define BITCOIN_BLOCKMAP_H
+
+#include <chain.h>
+#include <uint256.h>
+
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * The block index: a CBlockIndex for every known block, keyed by block hash.
+ *
+ * Entries are allocated from an arena of fixed-size chunks, so they are never
+ * moved and live next to the entries inserted before and after them. Each
+ * entry keeps its block hash, which the phashBlock of its CBlockIndex points
+ * to. Blocks are found through an open-addressing table of 8-byte slots, each
+ * holding part of the truncated block hash and the position of the entry in
+ * the arena. Entries cannot be removed individually, only all at once.
+ *
+ * Iteration visits the entries in the order they were inserted.
+ */
+class BlockMap
+{
+private:
+    struct Entry {
+        uint256 hash;
+        CBlockIndex index;
+    };
+
+    struct Slot {
+        //! Upper half of the truncated hash of the block, to skip most entries without reading them
+        uint32_t nTag;
+        //! Position of the entry in the arena plus one, or 0 for an empty slot
+        uint32_t nPos;
+    };
+
+    static constexpr unsigned int CHUNK_BITS = 12;
+    static constexpr size_t CHUNK_SIZE = size_t{1} << CHUNK_BITS;
+
+    std::vector<std::unique_ptr<Entry[]>> m_chunks;
+    std::vector<Slot> m_slots;
+    size_t m_size = 0;
+
+    Entry& GetEntry(size_t nPos) const { return m_chunks[nPos >> CHUNK_BITS][nPos & (CHUNK_SIZE - 1)]; }
+
+    /** Return the position of the slot of the given block, or of the empty slot it would go in. */
+    size_t FindSlot(const uint256& hash) const;
+
+    /** Resize the table to the given power of two number of slots. */
+    void Rehash(size_t nSlots);
+
+public:
+    typedef std::pair<const uint256&, CBlockIndex*> value_type;
+
+    class const_iterator
+    {
+    private:
+        const BlockMap* m_map;
+        size_t m_pos;
+
+    public:
+        struct pointer {
+            value_type value;
+            const value_type* operator->() const { return &value; }
+        };
+
+        const_iterator(const BlockMap* map, size_t pos) : m_map(map), m_pos(pos) {}
+
+        value_type operator*() const
+        {
+            Entry& entry = m_map->GetEntry(m_pos);
+            return value_type(entry.hash, &entry.index);
+        }
+        pointer operator->() const { return pointer{**this}; }
+        const_iterator& operator++() { ++m_pos; return *this; }
+        const_iterator operator++(int) { const_iterator ret = *this; ++m_pos; return ret; }
+        bool operator==(const const_iterator& other) const { return m_pos == other.m_pos; }
+        bool operator!=(const const_iterator& other) const { return m_pos != other.m_pos; }
+    };
+    typedef const_iterator iterator;
+
+    BlockMap() = default;
+    BlockMap(const BlockMap&) = delete;
+    BlockMap& operator=(const BlockMap&) = delete;
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const_iterator find(const uint256& hash) const;
+    size_t count(const uint256& hash) const { return find(hash) != end() ? 1 : 0; }
+
+    /** Return the entry of the given block, or nullptr if there is none. Never inserts. */
+    CBlockIndex* operator[](const uint256& hash) const;
+
+    /**
+     * Add an entry for the given block, constructing its CBlockIndex from
+     * args. If the block already has an entry, that entry is returned and
+     * left unchanged. The second element is true if the entry was added.
+     */
+    template <typename... Args>
+    std::pair<const_iterator, bool> emplace(const uint256& hash, Args&&... args)
+    {
+        // Keep the table at most three quarters full.
+        if ((m_size + 1) * 4 > m_slots.size() * 3) {
+            reserve(m_size + 1);
+        }
+        Slot& slot = m_slots[FindSlot(hash)];
+        if (slot.nPos != 0) {
+            return std::make_pair(const_iterator(this, slot.nPos - 1), false);
+        }
+        if ((m_size >> CHUNK_BITS) == m_chunks.size()) {
+            m_chunks.emplace_back(new Entry[CHUNK_SIZE]);
+        }
+        Entry& entry = GetEntry(m_size);
+        entry.hash = hash;
+        entry.index = CBlockIndex(std::forward<Args>(args)...);
+        entry.index.phashBlock = &entry.hash;
+        slot.nTag = hash.GetCheapHash() >> 32;
+        slot.nPos = ++m_size;
+        return std::make_pair(const_iterator(this, m_size - 1), true);
+    }
+
+    /** Make room for the given number of entries without rehashing. */
+    void reserve(size_t n);
+
+    /** Remove and free all entries. */
+    void clear();
+};
+
+#endif // BITCOIN_BLOCKMAP_H
@@ -7,10 +7,13 @@
 #include <consensus/consensus.h>
 #include <random.h>
 
+#include <algorithm>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWriteMove(PooledCoinsMap &coins, const uint256 &hashBlock) { return BatchWrite(*coins, hashBlock); }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -31,32 +34,85 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn, size_t nShards) : CCoinsViewBacked(baseIn), trimShard(0), trimBucket(0)
+{
+    m_shards.resize(std::max<size_t>(1, nShards));
+    for (std::unique_ptr<CacheShard>& shard : m_shards) {
+        shard.reset(new CacheShard());
+    }
+}
+
+size_t CCoinsViewCache::CacheShard::CompactedMemoryUsage() const
+{
+    const CCoinsMapMemoryResource& resource = *map->get_allocator().resource();
+    return DynamicMemoryUsage() - resource.NumAllocatedChunks() * memusage::MallocUsage(resource.ChunkSizeBytes()) + resource.UsedBytes();
+}
+
+void CCoinsViewCache::CacheShard::Reallocate()
+{
+    // The pool keeps the memory of freed entries for reuse, so it is only
+    // given back by starting over with a new pool.
+    map = PooledCoinsMap();
+    cachedCoinsUsage = 0;
+}
+
+void CCoinsViewCache::CacheShard::Compact()
+{
+    PooledCoinsMap compacted;
+    compacted->reserve(map->size());
+    for (auto& entry : *map) {
+        compacted->emplace(entry.first, std::move(entry.second));
+    }
+    map = std::move(compacted);
+}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    size_t nUsage = 0;
+    for (const std::unique_ptr<CacheShard>& shard : m_shards) {
+        std::unique_lock<std::mutex> lock = LockShard(*shard);
+        nUsage += shard->DynamicMemoryUsage();
+    }
+    return nUsage;
 }
 
-CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
-    CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint, CacheShard& shard, std::unique_lock<std::mutex>& lock) const {
+    CCoinsMap::iterator it = shard.map->find(outpoint);
+    if (it != shard.map->end()) {
+        it->second.referenced = true;
         return it;
+    }
     Coin tmp;
-    if (!base->GetCoin(outpoint, tmp))
-        return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
-    if (ret->second.coin.IsSpent()) {
+    bool fFound;
+    if (lock.owns_lock()) {
+        // Let lookups of other coins of the shard proceed meanwhile.
+        lock.unlock();
+        fFound = base->GetCoin(outpoint, tmp);
+        lock.lock();
+    } else {
+        fFound = base->GetCoin(outpoint, tmp);
+    }
+    if (!fFound)
+        return shard.map->end();
+    std::pair<CCoinsMap::iterator, bool> ret = shard.map->emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp)));
+    if (!ret.second) {
+        // A concurrent lookup of the same coin added it first.
+        ret.first->second.referenced = true;
+        return ret.first;
+    }
+    if (ret.first->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
-        ret->second.flags = CCoinsCacheEntry::FRESH;
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
-    return ret;
+    shard.cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
+    return ret.first;
 }
 
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
-    CCoinsMap::const_iterator it = FetchCoin(outpoint);
-    if (it != cacheCoins.end()) {
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    CCoinsMap::const_iterator it = FetchCoin(outpoint, shard, lock);
+    if (it != shard.map->end()) {
         coin = it->second.coin;
         return !coin.IsSpent();
     }
@@ -66,12 +122,14 @@ bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
     assert(!coin.IsSpent());
     if (coin.out.scriptPubKey.IsUnspendable()) return;
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
     CCoinsMap::iterator it;
     bool inserted;
-    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    std::tie(it, inserted) = shard.map->emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
     bool fresh = false;
     if (!inserted) {
-        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        shard.cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     }
     if (!possible_overwrite) {
         if (!it->second.coin.IsSpent()) {
@@ -81,7 +139,7 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
-    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    shard.cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
@@ -96,14 +154,16 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool
 }
 
 bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
-    CCoinsMap::iterator it = FetchCoin(outpoint);
-    if (it == cacheCoins.end()) return false;
-    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    CCoinsMap::iterator it = FetchCoin(outpoint, shard, lock);
+    if (it == shard.map->end()) return false;
+    shard.cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     if (moveout) {
         *moveout = std::move(it->second.coin);
     }
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
-        cacheCoins.erase(it);
+        shard.map->erase(it);
     } else {
         it->second.flags |= CCoinsCacheEntry::DIRTY;
         it->second.coin.Clear();
@@ -114,8 +174,10 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
 static const Coin coinEmpty;
 
 const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
-    CCoinsMap::const_iterator it = FetchCoin(outpoint);
-    if (it == cacheCoins.end()) {
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    CCoinsMap::const_iterator it = FetchCoin(outpoint, shard, lock);
+    if (it == shard.map->end()) {
         return coinEmpty;
     } else {
         return it->second.coin;
@@ -123,13 +185,17 @@ const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
 }
 
 bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
-    CCoinsMap::const_iterator it = FetchCoin(outpoint);
-    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    CCoinsMap::const_iterator it = FetchCoin(outpoint, shard, lock);
+    return (it != shard.map->end() && !it->second.coin.IsSpent());
 }
 
 bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
-    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
-    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    CCoinsMap::const_iterator it = shard.map->find(outpoint);
+    return (it != shard.map->end() && !it->second.coin.IsSpent());
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -148,16 +214,18 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
         }
-        CCoinsMap::iterator itUs = cacheCoins.find(it->first);
-        if (itUs == cacheCoins.end()) {
+        CacheShard& shard = GetShard(it->first);
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        CCoinsMap::iterator itUs = shard.map->find(it->first);
+        if (itUs == shard.map->end()) {
             // The parent cache does not have an entry, while the child does
             // We can ignore it if it's both FRESH and pruned in the child
             if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
                 // Otherwise we will need to create it in the parent
                 // and move the data up and mark it as dirty
-                CCoinsCacheEntry& entry = cacheCoins[it->first];
+                CCoinsCacheEntry& entry = (*shard.map)[it->first];
                 entry.coin = std::move(it->second.coin);
-                cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                shard.cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
                 // We can mark it FRESH in the parent if it was FRESH in the child
                 // Otherwise it might have just been flushed from the parent's cache
@@ -180,13 +248,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 // The grandparent does not have an entry, and the child is
                 // modified and being pruned. This means we can just delete
                 // it from the parent.
-                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                cacheCoins.erase(itUs);
+                shard.cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                shard.map->erase(itUs);
             } else {
                 // A normal modification.
-                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                shard.cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.coin = std::move(it->second.coin);
-                cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+                shard.cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 // NOTE: It is possible the child has a FRESH flag here in
                 // the event the entry we found in the parent is pruned. But
@@ -200,24 +268,148 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
     return true;
 }
 
-bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
-    cacheCoins.clear();
-    cachedCoinsUsage = 0;
-    return fOk;
+bool CCoinsViewCache::Flush(bool fErase, size_t nRetainUsage) {
+    // The base takes a single map so that it is updated atomically. A single
+    // shard that is erased anyway is handed over as it is. Otherwise the
+    // modified entries are gathered shard by shard. Those that are kept are
+    // copied, as long as the cache and the copies fit in nRetainUsage; the
+    // others are moved out, and their shard compacted right after if that is
+    // needed to give back the memory they took.
+    PooledCoinsMap mapDirty;
+    if (fErase && m_shards.size() == 1) {
+        mapDirty = std::move(m_shards[0]->map);
+        m_shards[0]->Reallocate();
+    } else {
+        // Size the buckets up front, so that they do not grow while the
+        // usage is being kept track of.
+        size_t nDirty = 0;
+        size_t nShardsUsage = 0;
+        for (const std::unique_ptr<CacheShard>& shard : m_shards) {
+            for (const auto& entry : *shard->map) {
+                nDirty += (entry.second.flags & CCoinsCacheEntry::DIRTY) != 0;
+            }
+            nShardsUsage += shard->DynamicMemoryUsage();
+        }
+        mapDirty->reserve(nDirty);
+        size_t nDirtyCoinsUsage = 0;
+        for (const std::unique_ptr<CacheShard>& shard : m_shards) {
+            bool fMoved = false;
+            for (CCoinsMap::iterator it = shard->map->begin(); it != shard->map->end();) {
+                if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+                    ++it;
+                    continue;
+                }
+                // A copy takes another node, which may need a new pool chunk,
+                // and the coin's memory again. Spent entries no longer exist
+                // in the base once written, so there is nothing to keep.
+                const size_t nCoinUsage = it->second.coin.DynamicMemoryUsage();
+                const size_t nUsage = nShardsUsage + memusage::DynamicUsage(*mapDirty) + nDirtyCoinsUsage;
+                const size_t nCopyUsage = memusage::MallocUsage(CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES) + nCoinUsage;
+                nDirtyCoinsUsage += nCoinUsage;
+                if (fErase || it->second.coin.IsSpent() || nUsage + nCopyUsage > nRetainUsage) {
+                    shard->cachedCoinsUsage -= nCoinUsage;
+                    nShardsUsage -= nCoinUsage;
+                    mapDirty->emplace(it->first, std::move(it->second));
+                    it = shard->map->erase(it);
+                    fMoved = true;
+                } else {
+                    // The base will match the written entry, so the one kept
+                    // is no longer modified.
+                    mapDirty->emplace(it->first, it->second);
+                    it->second.flags = 0;
+                    ++it;
+                }
+            }
+            const size_t nShardUsage = shard->DynamicMemoryUsage();
+            const size_t nUsage = nShardsUsage + memusage::DynamicUsage(*mapDirty) + nDirtyCoinsUsage;
+            if (fErase || shard->map->empty()) {
+                shard->Reallocate();
+            } else if (fMoved && (nUsage > nRetainUsage || nShardUsage - shard->CompactedMemoryUsage() > CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES)) {
+                shard->Compact();
+            }
+            nShardsUsage = nShardsUsage + shard->DynamicMemoryUsage() - nShardUsage;
+        }
+    }
+    return base->BatchWriteMove(mapDirty, hashBlock);
+}
+
+void CCoinsViewCache::Trim(size_t nTargetUsage)
+{
+    // Evicted entries only leave the pool's free lists, so count the usage
+    // the shards will have once compacted.
+    size_t nBuckets = 0;
+    size_t nUsage = 0;
+    for (const std::unique_ptr<CacheShard>& shard : m_shards) {
+        nBuckets += shard->map->bucket_count();
+        nUsage += shard->CompactedMemoryUsage();
+    }
+    std::vector<COutPoint> vEvict;
+    // Two passes over all buckets of all shards suffice: the first clears
+    // every referenced bit it does not evict.
+    for (size_t n = 0; n < 2 * nBuckets && nUsage > nTargetUsage; n++) {
+        while (trimBucket >= m_shards[trimShard]->map->bucket_count()) {
+            trimBucket = 0;
+            trimShard = (trimShard + 1) % m_shards.size();
+        }
+        CacheShard& shard = *m_shards[trimShard];
+        const size_t bucket = trimBucket++;
+        for (CCoinsMap::local_iterator it = shard.map->begin(bucket); it != shard.map->end(bucket); ++it) {
+            if (it->second.flags != 0) {
+                continue;
+            }
+            if (it->second.referenced) {
+                it->second.referenced = false;
+            } else {
+                vEvict.push_back(it->first);
+            }
+        }
+        nUsage -= shard.CompactedMemoryUsage();
+        for (const COutPoint& outpoint : vEvict) {
+            Uncache(outpoint);
+        }
+        nUsage += shard.CompactedMemoryUsage();
+        vEvict.clear();
+    }
+
+    // Release what the evicted entries, and any erased earlier, took. This
+    // moves the remaining entries, so it is only worth it for whole chunks.
+    for (const std::unique_ptr<CacheShard>& shard : m_shards) {
+        std::unique_lock<std::mutex> lock = LockShard(*shard);
+        if (shard->DynamicMemoryUsage() - shard->CompactedMemoryUsage() > CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES) {
+            shard->Compact();
+        }
+    }
 }
 
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
-    CCoinsMap::iterator it = cacheCoins.find(hash);
-    if (it != cacheCoins.end() && it->second.flags == 0) {
-        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
-        cacheCoins.erase(it);
+    CacheShard& shard = GetShard(hash);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    CCoinsMap::iterator it = shard.map->find(hash);
+    if (it != shard.map->end() && it->second.flags == 0) {
+        shard.cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        shard.map->erase(it);
+    }
+}
+
+void CCoinsViewCache::WarmCoin(const COutPoint &outpoint, Coin&& coin)
+{
+    assert(!coin.IsSpent());
+    CacheShard& shard = GetShard(outpoint);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    std::pair<CCoinsMap::iterator, bool> ret = shard.map->emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (ret.second) {
+        shard.cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
     }
 }
 
 unsigned int CCoinsViewCache::GetCacheSize() const {
-    return cacheCoins.size();
+    size_t nSize = 0;
+    for (const std::unique_ptr<CacheShard>& shard : m_shards) {
+        std::unique_lock<std::mutex> lock = LockShard(*shard);
+        nSize += shard->map->size();
+    }
+    return nSize;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
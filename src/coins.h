@@ -12,12 +12,17 @@
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 /**
  * A UTXO entry.
@@ -25,6 +30,10 @@
  * Serialized format:
  * - VARINT((coinbase ? 1 : 0) | (height << 1))
  * - the non-spent CTxOut (via CTxOutCompressor)
+ *
+ * In memory the output keeps its full script, however compactly it is
+ * serialized. Scripts longer than CScript's inline capacity, like a P2WSH
+ * output's 34 bytes, take a heap allocation that DynamicMemoryUsage counts.
  */
 class Coin
 {
@@ -94,8 +103,11 @@ public:
      * This *must* return size_t. With Boost 1.46 on 32-bit systems the
      * unordered_map will behave unpredictably if the custom hasher returns a
      * uint64_t, resulting in failures when syncing the chain (#4634).
+     *
+     * It is noexcept so that std::unordered_map does not store the hash in
+     * every node next to the key, which saves 8 bytes per cached coin.
      */
-    size_t operator()(const COutPoint& id) const {
+    size_t operator()(const COutPoint& id) const noexcept {
         return SipHashUint256Extra(k0, k1, id.hash, id.n);
     }
 };
@@ -104,6 +116,7 @@ struct CCoinsCacheEntry
 {
     Coin coin; // The actual cached data.
     unsigned char flags;
+    bool referenced; // Accessed since the last eviction sweep passed this entry (see CCoinsViewCache::Trim).
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -115,11 +128,55 @@ struct CCoinsCacheEntry
          */
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), referenced(false) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), referenced(false) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of a CCoinsMap are allocated from a pool, without the overhead of
+ * a malloc per coin. The pool blocks are sized to fit a node with some room
+ * to spare for the bookkeeping of any standard library.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>
+    CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
+
+/** Create an empty CCoinsMap that allocates from the given resource. */
+inline CCoinsMap MakeCoinsMap(CCoinsMapMemoryResource& resource)
+{
+    return CCoinsMap(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CCoinsMapAllocator(&resource));
+}
+
+/**
+ * A CCoinsMap together with the pool it allocates from. The pool only gives
+ * memory back when it is destroyed, so a map that shrank is replaced by a new
+ * one to release it. A moved-from instance may only be assigned to or
+ * destroyed.
+ */
+class PooledCoinsMap
+{
+private:
+    //! Declared first, so that it outlives the map
+    std::unique_ptr<CCoinsMapMemoryResource> m_resource;
+    std::unique_ptr<CCoinsMap> m_map;
+
+public:
+    PooledCoinsMap() : m_resource(new CCoinsMapMemoryResource()), m_map(new CCoinsMap(MakeCoinsMap(*m_resource))) {}
+    PooledCoinsMap(PooledCoinsMap&& other) = default;
+
+    PooledCoinsMap& operator=(PooledCoinsMap&& other)
+    {
+        // Destroy the old map before the pool it allocates from.
+        m_map = std::move(other.m_map);
+        m_resource = std::move(other.m_resource);
+        return *this;
+    }
+
+    CCoinsMap& operator*() const { return *m_map; }
+    CCoinsMap* operator->() const { return m_map.get(); }
+};
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -167,6 +224,10 @@ public:
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
+    //! Like BatchWrite, but the view may take coins over, pool included, and
+    //! leave an empty map in its place instead of copying the entries.
+    virtual bool BatchWriteMove(PooledCoinsMap &coins, const uint256 &hashBlock);
+
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
@@ -197,22 +258,65 @@ public:
 };
 
 
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/**
+ * CCoinsView that adds a memory cache for transactions to another CCoinsView
+ *
+ * The cache is split into shards by a salted hash of the outpoint, each with
+ * its own map and lock. A cache with more than one shard can be read from
+ * several threads at once: GetCoin, HaveCoin, AccessCoin and HaveCoinInCache
+ * may run concurrently with each other, provided the backing view supports
+ * concurrent reads too. Everything else, including all modifications, needs
+ * exclusive access to the cache. A cache with a single shard takes no locks
+ * and is not thread-safe at all.
+ */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
+    struct CacheShard {
+        std::mutex mutex;
+        PooledCoinsMap map;
+        /* Cached dynamic memory usage for the inner Coin objects. */
+        size_t cachedCoinsUsage;
+
+        CacheShard() : cachedCoinsUsage(0) {}
+
+        size_t DynamicMemoryUsage() const { return memusage::DynamicUsage(*map) + cachedCoinsUsage; }
+
+        /** The usage once compacted, leaving out the pool memory of erased entries. */
+        size_t CompactedMemoryUsage() const;
+
+        /** Drop all entries, and give back the memory they took. */
+        void Reallocate();
+
+        /** Move the entries to a new pool, giving back the memory of erased ones. */
+        void Compact();
+    };
+
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".  
      */
     mutable uint256 hashBlock;
-    mutable CCoinsMap cacheCoins;
+    const SaltedOutpointHasher m_shard_hasher;
+    mutable std::vector<std::unique_ptr<CacheShard>> m_shards;
 
-    /* Cached dynamic memory usage for the inner Coin objects. */
-    mutable size_t cachedCoinsUsage;
+    /* Shard and bucket at which the next Trim() sweep resumes. */
+    size_t trimShard;
+    size_t trimBucket;
+
+    CacheShard& GetShard(const COutPoint& outpoint) const
+    {
+        return m_shards.size() == 1 ? *m_shards[0] : *m_shards[m_shard_hasher(outpoint) % m_shards.size()];
+    }
+
+    /** Lock a shard against concurrent lookups, if there can be any. */
+    std::unique_lock<std::mutex> LockShard(CacheShard& shard) const
+    {
+        return m_shards.size() == 1 ? std::unique_lock<std::mutex>() : std::unique_lock<std::mutex>(shard.mutex);
+    }
 
 public:
-    CCoinsViewCache(CCoinsView *baseIn);
+    CCoinsViewCache(CCoinsView *baseIn, size_t nShards = 1);
 
     /**
      * By deleting the copy constructor, we prevent accidentally using it when one intends to create a cache on top of a base cache.
@@ -264,9 +368,26 @@ public:
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
+     * If fErase is false, only the modified entries are written and the cache
+     * keeps the unspent entries, which are then no longer marked as modified.
+     * The modified ones are kept by copying them, but only while the usage of
+     * the cache together with that of the entries handed to the base stays
+     * within nRetainUsage; the rest are moved to the base and evicted. Until
+     * a shard is compacted, the memory of the entries moved out of it is
+     * held twice, so this may briefly exceed nRetainUsage by that of one
+     * shard.
      * If false is returned, the state of this cache (and its backing view) will be undefined.
      */
-    bool Flush();
+    bool Flush(bool fErase = true, size_t nRetainUsage = std::numeric_limits<size_t>::max());
+
+    /**
+     * Evict unmodified entries until DynamicMemoryUsage() is at most
+     * nTargetUsage, or no more entries can be evicted. Entries accessed since
+     * the previous sweep are spared once (clock algorithm). Shards that
+     * evicted entries are compacted to release their memory, which may leave
+     * the usage up to a pool chunk per shard above nTargetUsage.
+     */
+    void Trim(size_t nTargetUsage);
 
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
@@ -274,6 +395,14 @@ public:
      */
     void Uncache(const COutPoint &outpoint);
 
+    /**
+     * Insert a coin that was read from the backing view without going
+     * through it, e.g. by a prefetch worker. The entry is added unmodified,
+     * exactly as if it had been fetched on a cache miss. Does nothing if the
+     * outpoint is already cached.
+     */
+    void WarmCoin(const COutPoint &outpoint, Coin&& coin);
+
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
@@ -294,7 +423,12 @@ public:
     bool HaveInputs(const CTransaction& tx) const;
 
 private:
-    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+    /**
+     * Return the entry of the given outpoint in its shard, fetching it from
+     * the backing view if needed, or the end of the shard's map if there is
+     * none. The shard is unlocked while the backing view is read.
+     */
+    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint, CacheShard& shard, std::unique_lock<std::mutex>& lock) const;
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -0,0 +1,48 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsfilter.h>
+
+#include <hash.h>
+#include <random.h>
+
+#include <algorithm>
+#include <limits>
+
+CoinsFilter::CoinsFilter(size_t nSizeBytes) :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())),
+    m_num_blocks(std::min<size_t>(std::max<size_t>(1, nSizeBytes / (WORDS_PER_BLOCK * sizeof(uint64_t))), std::numeric_limits<uint32_t>::max())),
+    m_words(new std::atomic<uint64_t>[m_num_blocks * WORDS_PER_BLOCK])
+{
+    for (size_t i = 0; i < m_num_blocks * WORDS_PER_BLOCK; i++) {
+        m_words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void CoinsFilter::Insert(const COutPoint& outpoint)
+{
+    const uint64_t hash = SipHashUint256Extra(k0, k1, outpoint.hash, outpoint.n);
+    std::atomic<uint64_t>* block = GetBlock(hash);
+    // The probes within the block are derived from the high 32 bits by double hashing.
+    const uint32_t a = hash >> 32, b = (hash >> 41) | 1;
+    for (int i = 0; i < NUM_PROBES; i++) {
+        const uint32_t bit = (a + i * b) % BITS_PER_BLOCK;
+        block[bit / 64].fetch_or((uint64_t)1 << (bit % 64), std::memory_order_relaxed);
+    }
+    m_inserted.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool CoinsFilter::MayContain(const COutPoint& outpoint) const
+{
+    const uint64_t hash = SipHashUint256Extra(k0, k1, outpoint.hash, outpoint.n);
+    const std::atomic<uint64_t>* block = GetBlock(hash);
+    const uint32_t a = hash >> 32, b = (hash >> 41) | 1;
+    for (int i = 0; i < NUM_PROBES; i++) {
+        const uint32_t bit = (a + i * b) % BITS_PER_BLOCK;
+        if (!(block[bit / 64].load(std::memory_order_relaxed) & ((uint64_t)1 << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSFILTER_H
+#define BITCOIN_COINSFILTER_H
+
+#include <primitives/transaction.h>
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+/** -coinsfilter default (MiB) */
+static const int64_t DEFAULT_COINS_FILTER_SIZE = 0;
+
+/**
+ * A bloom filter over outpoints, which tells for certain that a coin is not
+ * in the set it was built from.
+ *
+ * The bits of an outpoint all fall in one block of 512 bits, so that a lookup
+ * touches a single cache line. Outpoints cannot be removed: the filter only
+ * gets less selective as more are inserted, and has to be rebuilt to forget
+ * spent coins. Inserts and lookups can be made from any number of threads at
+ * once.
+ */
+class CoinsFilter
+{
+private:
+    static const size_t WORDS_PER_BLOCK = 8;
+    static const int BITS_PER_BLOCK = 512;
+    static const int NUM_PROBES = 6;
+
+    //! Salt
+    const uint64_t k0, k1;
+    const size_t m_num_blocks;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+    std::atomic<uint64_t> m_inserted{0};
+
+    std::atomic<uint64_t>* GetBlock(uint64_t hash) const
+    {
+        // Map the low 32 bits of the hash onto the blocks without a division.
+        return &m_words[((hash & 0xffffffff) * m_num_blocks >> 32) * WORDS_PER_BLOCK];
+    }
+
+public:
+    //! Bits per element at which the filter is reported to be full
+    static const int BITS_PER_ELEMENT = 10;
+
+    /** Create an empty filter of about nSizeBytes. */
+    explicit CoinsFilter(size_t nSizeBytes);
+
+    CoinsFilter(const CoinsFilter&) = delete;
+    CoinsFilter& operator=(const CoinsFilter&) = delete;
+
+    void Insert(const COutPoint& outpoint);
+
+    /** Whether outpoint may have been inserted. False means it was not. */
+    bool MayContain(const COutPoint& outpoint) const;
+
+    //! Number of insertions so far, counting outpoints inserted more than once
+    uint64_t GetInserted() const { return m_inserted.load(std::memory_order_relaxed); }
+
+    //! Number of elements up to which the filter keeps a low false positive rate (about 1%)
+    uint64_t GetCapacity() const { return (uint64_t)m_num_blocks * BITS_PER_BLOCK / BITS_PER_ELEMENT; }
+
+    size_t DynamicMemoryUsage() const { return m_num_blocks * WORDS_PER_BLOCK * sizeof(uint64_t); }
+};
+
+#endif // BITCOIN_COINSFILTER_H
@@ -45,7 +45,17 @@ bool CScriptCompressor::IsToPubKey(CPubKey &pubkey) const
     return false;
 }
 
-bool CScriptCompressor::Compress(std::vector<unsigned char> &out) const
+bool CScriptCompressor::IsToWitnessProgram(std::vector<unsigned char> &program) const
+{
+    if ((script.size() == 22 && script[0] == OP_0 && script[1] == 20) ||
+        (script.size() == 34 && script[0] == OP_0 && script[1] == 32)) {
+        program.assign(script.begin() + 2, script.end());
+        return true;
+    }
+    return false;
+}
+
+bool CScriptCompressor::Compress(std::vector<unsigned char> &out, bool fWitness) const
 {
     CKeyID keyID;
     if (IsToKeyID(keyID)) {
@@ -73,14 +83,21 @@ bool CScriptCompressor::Compress(std::vector<unsigned char> &out) const
             return true;
         }
     }
+    std::vector<unsigned char> program;
+    if (fWitness && IsToWitnessProgram(program)) {
+        out.resize(1 + program.size());
+        out[0] = program.size() == 20 ? 0x06 : 0x07;
+        memcpy(&out[1], program.data(), program.size());
+        return true;
+    }
     return false;
 }
 
 unsigned int CScriptCompressor::GetSpecialSize(unsigned int nSize) const
 {
-    if (nSize == 0 || nSize == 1)
+    if (nSize == 0 || nSize == 1 || nSize == 6)
         return 20;
-    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5)
+    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5 || nSize == 7)
         return 32;
     return 0;
 }
@@ -112,6 +129,13 @@ bool CScriptCompressor::Decompress(unsigned int nSize, const std::vector<unsigne
         memcpy(&script[2], in.data(), 32);
         script[34] = OP_CHECKSIG;
         return true;
+    case 0x06:
+    case 0x07:
+        script.resize(2 + in.size());
+        script[0] = OP_0;
+        script[1] = in.size();
+        memcpy(&script[2], in.data(), in.size());
+        return true;
     case 0x04:
     case 0x05:
         unsigned char vch[33] = {};
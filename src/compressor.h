@@ -14,6 +14,14 @@ class CKeyID;
 class CPubKey;
 class CScriptID;
 
+/**
+ * Serialization flag for CScriptCompressor to also compress version 0 witness
+ * programs. This changes the encoding of all other scripts too, so it may only
+ * be set for a stored format defined with it; the chainstate database keeps
+ * the encoding without it, which older versions can read.
+ */
+static const int SERIALIZE_COMPRESS_WITNESS_PROGRAMS = 0x20000000;
+
 /** Compact serializer for scripts.
  *
  *  It detects common cases and encodes them much more efficiently.
@@ -22,19 +30,26 @@ class CScriptID;
  *  * Pay to script hash (encoded as 21 bytes)
  *  * Pay to pubkey starting with 0x02, 0x03 or 0x04 (encoded as 33 bytes)
  *
- *  Other scripts up to 121 bytes require 1 byte + script length. Above
- *  that, scripts up to 16505 bytes require 2 bytes + script length.
+ *  With SERIALIZE_COMPRESS_WITNESS_PROGRAMS, 2 more are defined:
+ *  * Pay to witness pubkey hash (encoded as 21 bytes)
+ *  * Pay to witness script hash (encoded as 33 bytes)
+ *
+ *  Other scripts up to 121 bytes (119 with the flag) require 1 byte + script
+ *  length. Above that, scripts up to 16505 bytes require 2 bytes + script
+ *  length.
  */
 class CScriptCompressor
 {
 private:
     /**
-     * make this static for now (there are only 6 special scripts defined)
+     * make this static for now (there are only 6 special scripts defined,
+     * 8 with SERIALIZE_COMPRESS_WITNESS_PROGRAMS)
      * this can potentially be extended together with a new nVersion for
      * transactions, in which case this value becomes dependent on nVersion
      * and nHeight of the enclosing transaction.
      */
     static const unsigned int nSpecialScripts = 6;
+    static const unsigned int nSpecialScriptsWitness = 8;
 
     CScript &script;
 protected:
@@ -48,8 +63,9 @@ protected:
     bool IsToKeyID(CKeyID &hash) const;
     bool IsToScriptID(CScriptID &hash) const;
     bool IsToPubKey(CPubKey &pubkey) const;
+    bool IsToWitnessProgram(std::vector<unsigned char> &program) const;
 
-    bool Compress(std::vector<unsigned char> &out) const;
+    bool Compress(std::vector<unsigned char> &out, bool fWitness) const;
     unsigned int GetSpecialSize(unsigned int nSize) const;
     bool Decompress(unsigned int nSize, const std::vector<unsigned char> &out);
 public:
@@ -57,27 +73,29 @@ public:
 
     template<typename Stream>
     void Serialize(Stream &s) const {
+        const bool fWitness = s.GetVersion() & SERIALIZE_COMPRESS_WITNESS_PROGRAMS;
         std::vector<unsigned char> compr;
-        if (Compress(compr)) {
+        if (Compress(compr, fWitness)) {
             s << CFlatData(compr);
             return;
         }
-        unsigned int nSize = script.size() + nSpecialScripts;
+        unsigned int nSize = script.size() + (fWitness ? nSpecialScriptsWitness : nSpecialScripts);
         s << VARINT(nSize);
         s << CFlatData(script);
     }
 
     template<typename Stream>
     void Unserialize(Stream &s) {
+        const unsigned int nSpecial = (s.GetVersion() & SERIALIZE_COMPRESS_WITNESS_PROGRAMS) ? nSpecialScriptsWitness : nSpecialScripts;
         unsigned int nSize = 0;
         s >> VARINT(nSize);
-        if (nSize < nSpecialScripts) {
+        if (nSize < nSpecial) {
             std::vector<unsigned char> vch(GetSpecialSize(nSize), 0x00);
             s >> REF(CFlatData(vch));
             Decompress(nSize, vch);
             return;
         }
-        nSize -= nSpecialScripts;
+        nSize -= nSpecial;
         if (nSize > MAX_SCRIPT_SIZE) {
             // Overly long script, replace with a short invalid one
             script << OP_RETURN;
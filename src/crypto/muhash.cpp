@@ -0,0 +1,255 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <string.h>
+
+namespace {
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+constexpr int LIMBS = Num3072::LIMBS;
+constexpr int LIMB_SIZE = Num3072::LIMB_SIZE;
+/** 2^3072 - MAX_PRIME_DIFF is the modulus. */
+constexpr limb_t MAX_PRIME_DIFF = 1103717;
+
+bool IsOne(const limb_t* a)
+{
+    if (a[0] != 1) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (a[i] != 0) return false;
+    }
+    return true;
+}
+
+int Compare(const limb_t* a, const limb_t* b)
+{
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/** a -= b, returning the borrow. */
+limb_t Sub(limb_t* a, const limb_t* b)
+{
+    limb_t borrow = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t t = (double_limb_t)a[i] - b[i] - borrow;
+        a[i] = (limb_t)t;
+        borrow = (limb_t)(t >> LIMB_SIZE) & 1;
+    }
+    return borrow;
+}
+
+/** a = (a - b) mod p, for a and b in [0, p). */
+void SubMod(limb_t* a, const limb_t* b)
+{
+    if (Sub(a, b)) {
+        // a - b + 2^3072 was computed; subtracting MAX_PRIME_DIFF turns it
+        // into a - b + p without underflowing.
+        limb_t borrow = MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && borrow; ++i) {
+            double_limb_t t = (double_limb_t)a[i] - borrow;
+            a[i] = (limb_t)t;
+            borrow = (limb_t)(t >> LIMB_SIZE) & 1;
+        }
+    }
+}
+
+/** a >>= 1, shifting in top_bit at the top. */
+void ShiftRight(limb_t* a, limb_t top_bit)
+{
+    for (int i = 0; i < LIMBS - 1; ++i) {
+        a[i] = (a[i] >> 1) | (a[i + 1] << (LIMB_SIZE - 1));
+    }
+    a[LIMBS - 1] = (a[LIMBS - 1] >> 1) | (top_bit << (LIMB_SIZE - 1));
+}
+
+/** a = a / 2 mod p, for a in [0, p). */
+void HalveMod(limb_t* a)
+{
+    if ((a[0] & 1) == 0) {
+        ShiftRight(a, 0);
+        return;
+    }
+    // a + p = a + 2^3072 - MAX_PRIME_DIFF is even, and below 2^3073.
+    limb_t borrow = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && borrow; ++i) {
+        double_limb_t t = (double_limb_t)a[i] - borrow;
+        a[i] = (limb_t)t;
+        borrow = (limb_t)(t >> LIMB_SIZE) & 1;
+    }
+    // Without a borrow, a - MAX_PRIME_DIFF + 2^3072 has its top bit set.
+    ShiftRight(a, borrow ^ 1);
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+#ifdef __SIZEOF_INT128__
+        limbs[i] = ReadLE64(data + 8 * i);
+#else
+        limbs[i] = ReadLE32(data + 4 * i);
+#endif
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+#ifdef __SIZEOF_INT128__
+        WriteLE64(out + 8 * i, limbs[i]);
+#else
+        WriteLE32(out + 4 * i, limbs[i]);
+#endif
+    }
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= (limb_t)0 - MAX_PRIME_DIFF - 1) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != (limb_t)-1) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting p is adding MAX_PRIME_DIFF and dropping the 2^3072 bit.
+    limb_t carry = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && carry; ++i) {
+        double_limb_t t = (double_limb_t)limbs[i] + carry;
+        limbs[i] = (limb_t)t;
+        carry = (limb_t)(t >> LIMB_SIZE);
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    limb_t tmp[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        limb_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            double_limb_t t = (double_limb_t)limbs[i] * a.limbs[j] + tmp[i + j] + carry;
+            tmp[i + j] = (limb_t)t;
+            carry = (limb_t)(t >> LIMB_SIZE);
+        }
+        tmp[i + LIMBS] = carry;
+    }
+
+    // The high half is worth MAX_PRIME_DIFF times its value modulo p.
+    limb_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t t = (double_limb_t)tmp[i + LIMBS] * MAX_PRIME_DIFF + tmp[i] + carry;
+        limbs[i] = (limb_t)t;
+        carry = (limb_t)(t >> LIMB_SIZE);
+    }
+    while (carry) {
+        double_limb_t t = (double_limb_t)carry * MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS; ++i) {
+            t += limbs[i];
+            limbs[i] = (limb_t)t;
+            t >>= LIMB_SIZE;
+        }
+        carry = (limb_t)t;
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Binary extended Euclidean algorithm. This runs in variable time, which
+    // is fine as the inputs are hashes of public data. The invariants are
+    // x1 * this = u and x2 * this = v (mod p).
+    Num3072 u(*this), v, x1, x2;
+    v.limbs[0] = (limb_t)0 - MAX_PRIME_DIFF;
+    for (int i = 1; i < LIMBS; ++i) {
+        v.limbs[i] = (limb_t)-1;
+    }
+    memset(x2.limbs, 0, sizeof(x2.limbs));
+
+    while (!IsOne(u.limbs) && !IsOne(v.limbs)) {
+        while ((u.limbs[0] & 1) == 0) {
+            ShiftRight(u.limbs, 0);
+            HalveMod(x1.limbs);
+        }
+        while ((v.limbs[0] & 1) == 0) {
+            ShiftRight(v.limbs, 0);
+            HalveMod(x2.limbs);
+        }
+        if (Compare(u.limbs, v.limbs) >= 0) {
+            Sub(u.limbs, v.limbs);
+            SubMod(x1.limbs, x2.limbs);
+        } else {
+            Sub(v.limbs, u.limbs);
+            SubMod(x2.limbs, x1.limbs);
+        }
+    }
+    return IsOne(u.limbs) ? x1 : x2;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Output(tmp, sizeof(tmp));
+    return Num3072(tmp);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    m_numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    m_denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& other)
+{
+    m_numerator.Multiply(other.m_numerator);
+    m_denominator.Multiply(other.m_denominator);
+    return *this;
+}
+
+const Num3072& MuHash3072::Normalize()
+{
+    m_numerator.Divide(m_denominator);
+    m_denominator.SetToOne();
+    return m_numerator;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    unsigned char data[Num3072::BYTE_SIZE];
+    Normalize().ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An integer modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static constexpr int LIMBS = 48;
+    static constexpr int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static constexpr int LIMBS = 96;
+    static constexpr int LIMB_SIZE = 32;
+#endif
+    static constexpr size_t BYTE_SIZE = 384;
+
+    /** Little-endian limbs, always fully reduced. */
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    /** Construct from a little-endian encoding, reducing it if needed. */
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings that can be updated incrementally and does
+ * not depend on the order of updates (MuHash). Every element is hashed to a
+ * number modulo a 3072-bit prime, and the set hash is the product of the
+ * numbers of its elements. Elements can be removed as well as added, by
+ * keeping removed elements in a separate denominator until the hash is
+ * finalized.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    /** Create the hash of the empty set. */
+    MuHash3072() {}
+    /** Continue from a state returned by Normalize. */
+    explicit MuHash3072(const Num3072& state) : m_numerator(state) {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    /** Combine with another set hash, giving the hash of their multiset union. */
+    MuHash3072& operator*=(const MuHash3072& other);
+
+    /** Divide out the denominator, and return the single number that now represents the set. */
+    const Num3072& Normalize();
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
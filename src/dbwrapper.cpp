@@ -5,6 +5,7 @@
 #include <dbwrapper.h>
 
 #include <random.h>
+#include <utilstrencodings.h>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -71,14 +72,56 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+bool ApplyDBOptions(const std::vector<std::string>& options, const std::string& name, DBProfile& profile, std::string& error)
+{
+    for (const std::string& option : options) {
+        const size_t nDot = option.find('.');
+        const size_t nEquals = option.find('=');
+        if (nDot == std::string::npos || nEquals == std::string::npos || nEquals < nDot) {
+            error = strprintf("Database option malformed, expecting database.setting=value: %s", option);
+            return false;
+        }
+        if (option.substr(0, nDot) != name) {
+            continue;
+        }
+        const std::string setting = option.substr(nDot + 1, nEquals - nDot - 1);
+        int32_t nValue;
+        if (!ParseInt32(option.substr(nEquals + 1), &nValue)) {
+            error = strprintf("Invalid value for database option %s", option);
+            return false;
+        }
+        if (setting == "compression" && (nValue == 0 || nValue == 1)) {
+            if (nValue == 1 && !leveldb::SnappyCompressionSupported()) {
+                error = strprintf("Database option %s needs LevelDB built with snappy, which this build does not have", option);
+                return false;
+            }
+            profile.compression = nValue;
+        } else if (setting == "bloombits" && nValue >= 0 && nValue <= 64) {
+            profile.bloom_bits = nValue;
+        } else if (setting == "blocksize" && nValue >= 1024 && nValue <= (4 << 20)) {
+            profile.block_size = nValue;
+        } else if (setting == "maxopenfiles" && nValue >= 64 && nValue <= 1000) {
+            profile.max_open_files = nValue;
+        } else if (setting == "subcompactions" && nValue >= 1 && nValue <= 64) {
+            profile.max_subcompactions = nValue;
+        } else {
+            error = strprintf("Invalid database option %s", option);
+            return false;
+        }
+    }
+    return true;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const DBProfile& profile)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.filter_policy = profile.bloom_bits > 0 ? leveldb::NewBloomFilterPolicy(profile.bloom_bits) : nullptr;
+    options.compression = profile.compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.block_size = profile.block_size;
+    options.max_open_files = profile.max_open_files;
+    options.max_subcompactions = profile.max_subcompactions;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -88,14 +131,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const DBProfile& profile)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -107,7 +150,8 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
             dbwrapper_private::HandleError(result);
         }
         TryCreateDirectories(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("Opening LevelDB in %s (compression=%d bloombits=%d blocksize=%u maxopenfiles=%d subcompactions=%d)\n", path.string(),
+            profile.compression, profile.bloom_bits, profile.block_size, profile.max_open_files, profile.max_subcompactions);
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
@@ -187,6 +231,33 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+DBWriteStalls CDBWrapper::GetWriteStalls() const
+{
+    DBWriteStalls stalls;
+    std::string value;
+    unsigned long long v[6];
+    if (pdb->GetProperty("leveldb.writestalls", &value) &&
+        sscanf(value.c_str(), "slowdowns %llu %llu memtable-waits %llu %llu level0-waits %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 6) {
+        stalls.slowdowns = v[0];
+        stalls.slowdown_micros = v[1];
+        stalls.memtable_waits = v[2];
+        stalls.memtable_micros = v[3];
+        stalls.level0_waits = v[4];
+        stalls.level0_micros = v[5];
+    }
+    return stalls;
+}
+
+size_t CDBWrapper::DynamicMemoryUsage() const
+{
+    std::string value;
+    uint64_t nUsage = 0;
+    if (pdb->GetProperty("leveldb.approximate-memory-usage", &value)) {
+        ParseUInt64(value, &nUsage);
+    }
+    return nUsage;
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() const { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
@@ -16,9 +16,50 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+/** LevelDB settings that can differ between databases. */
+struct DBProfile
+{
+    //! Compress tables with snappy, which LevelDB must be built with
+    bool compression = false;
+    //! Bits per key of the bloom filter of each table, 0 for none
+    int bloom_bits = 10;
+    //! Bytes of keys and values per table block, before compression
+    size_t block_size = 4096;
+    //! Files kept open, table files and about 10 others (LevelDB uses at least 74)
+    int max_open_files = 64;
+    //! Threads that a compaction is split over, by key range
+    int max_subcompactions = 1;
+};
+
+/** Writes that LevelDB held up because compactions fell behind. */
+struct DBWriteStalls
+{
+    //! Writes delayed by 1ms because level 0 is filling up
+    uint64_t slowdowns = 0;
+    uint64_t slowdown_micros = 0;
+    //! Waits for the previous write buffer to be written out
+    uint64_t memtable_waits = 0;
+    uint64_t memtable_micros = 0;
+    //! Waits because level 0 has too many files
+    uint64_t level0_waits = 0;
+    uint64_t level0_micros = 0;
+};
+
+/**
+ * Apply the "<name>.<setting>=<value>" entries of options, as given with
+ * -dboption, that are for the database called name to profile. Returns false,
+ * and sets error, if one of them cannot be parsed, or asks for compression in
+ * a build without snappy.
+ */
+bool ApplyDBOptions(const std::vector<std::string>& options, const std::string& name, DBProfile& profile, std::string& error);
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -119,15 +160,18 @@ class CDBIterator
 private:
     const CDBWrapper &parent;
     leveldb::Iterator *piter;
+    //! Snapshot the iterator reads from, kept alive as long as the iterator.
+    std::shared_ptr<const leveldb::Snapshot> snapshot;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
      * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _snapshot        Snapshot the iterator reads from, if any.
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
-        parent(_parent), piter(_piter) { };
+    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter, std::shared_ptr<const leveldb::Snapshot> _snapshot = nullptr) :
+        parent(_parent), piter(_piter), snapshot(std::move(_snapshot)) { };
     ~CDBIterator();
 
     bool Valid() const;
@@ -217,8 +261,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] profile     LevelDB settings for compression, filters, blocks and files.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const DBProfile& profile = DBProfile());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -301,11 +346,40 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /**
+     * Take a snapshot of the current state of the database. It is released
+     * once the last reference to it, including those held by iterators, is
+     * dropped.
+     */
+    std::shared_ptr<const leveldb::Snapshot> GetSnapshot()
+    {
+        leveldb::DB* db = pdb;
+        return std::shared_ptr<const leveldb::Snapshot>(pdb->GetSnapshot(),
+            [db](const leveldb::Snapshot* s) { db->ReleaseSnapshot(s); });
+    }
+
+    /**
+     * Return an iterator over the given snapshot. Iterators over the same
+     * snapshot see the same state, however the database changes meanwhile.
+     */
+    CDBIterator *NewIterator(const std::shared_ptr<const leveldb::Snapshot>& snapshot)
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot.get();
+        return new CDBIterator(*this, pdb->NewIterator(options), snapshot);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
 
+    //! Write stalls since the database was opened
+    DBWriteStalls GetWriteStalls() const;
+
+    //! Memory used by the block cache and write buffers
+    size_t DynamicMemoryUsage() const;
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
@@ -0,0 +1,150 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <crypto/muhash.h>
+#include <index/coinstatsindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+std::unique_ptr<CoinStatsIndex> g_coinstatsindex;
+
+uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+CDataStream TxOutSer(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+static void ApplyCoin(MuHash3072& muhash, CoinStatsRecord& stats, const COutPoint& outpoint, const Coin& coin, bool fSpend)
+{
+    const CDataStream ss = TxOutSer(outpoint, coin);
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(ss.data());
+    const uint64_t nBogoSize = GetBogoSize(coin.out.scriptPubKey);
+    if (fSpend) {
+        muhash.Remove(data, ss.size());
+        stats.nTransactionOutputs--;
+        stats.nTotalAmount -= coin.out.nValue;
+        stats.nBogoSize -= nBogoSize;
+    } else {
+        muhash.Insert(data, ss.size());
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += coin.out.nValue;
+        stats.nBogoSize += nBogoSize;
+    }
+}
+
+/**
+ * Two mainnet blocks have coinbase transactions identical to those of earlier
+ * blocks (see BIP30). Their outputs replaced the earlier ones in the UTXO set
+ * instead of being added next to them. Returns the height of the block whose
+ * coinbase outputs the given block replaced, or 0.
+ */
+static int GetReplacedCoinbaseHeight(const CBlockIndex* pindex)
+{
+    if (pindex->nHeight == 91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) {
+        return 91812;
+    }
+    if (pindex->nHeight == 91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")) {
+        return 91722;
+    }
+    return 0;
+}
+
+CoinStatsIndex::CoinStatsIndex(std::unique_ptr<CoinStatsIndexDB> db) : m_db(std::move(db)) {}
+
+CoinStatsIndex::~CoinStatsIndex()
+{
+    // Stop the sync thread while the database is still around.
+    Interrupt();
+    Stop();
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CoinStatsRecord stats;
+    MuHash3072 muhash;
+
+    // The outputs of the genesis block are not added to the UTXO set, so the
+    // UTXO set is empty as of the genesis block, which the index does not
+    // necessarily write.
+    if (pindex->nHeight > 0) {
+        if (pindex->pprev->nHeight > 0) {
+            if (!m_db->ReadStats(pindex->pprev->GetBlockHash(), stats)) {
+                return error("%s: Missing statistics for parent block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+            }
+            if (stats.vMuHashState.size() != Num3072::BYTE_SIZE) {
+                return error("%s: Invalid statistics for parent block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+            }
+            unsigned char state[Num3072::BYTE_SIZE];
+            std::copy(stats.vMuHashState.begin(), stats.vMuHashState.end(), state);
+            muhash = MuHash3072(Num3072(state));
+        }
+
+        CBlockUndo blockundo;
+        if (!UndoReadFromDisk(blockundo, pindex)) {
+            return false;
+        }
+        if (blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: Undo data mismatch for block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+
+        const int nReplacedHeight = GetReplacedCoinbaseHeight(pindex);
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            for (size_t j = 0; j < tx.vout.size(); j++) {
+                if (tx.vout[j].scriptPubKey.IsUnspendable()) {
+                    continue;
+                }
+                const COutPoint outpoint(tx.GetHash(), j);
+                if (nReplacedHeight != 0 && tx.IsCoinBase()) {
+                    ApplyCoin(muhash, stats, outpoint, Coin(tx.vout[j], nReplacedHeight, true), true);
+                }
+                ApplyCoin(muhash, stats, outpoint, Coin(tx.vout[j], pindex->nHeight, tx.IsCoinBase()), false);
+            }
+            if (tx.IsCoinBase()) {
+                continue;
+            }
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size()) {
+                return error("%s: Undo data mismatch for block %s", __func__, pindex->GetBlockHash().ToString());
+            }
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                // Undo data written before 0.15 only kept the height of the
+                // last spent output of a transaction.
+                if (txundo.vprevout[j].nHeight == 0) {
+                    return error("%s: Undo data for block %s lacks coin heights, a -reindex is required",
+                                 __func__, pindex->GetBlockHash().ToString());
+                }
+                ApplyCoin(muhash, stats, tx.vin[j].prevout, txundo.vprevout[j], true);
+            }
+        }
+    }
+
+    unsigned char state[Num3072::BYTE_SIZE];
+    muhash.Normalize().ToBytes(state);
+    stats.vMuHashState.assign(state, state + sizeof(state));
+    muhash.Finalize(stats.hashMuHash.begin());
+    return m_db->WriteStats(pindex->GetBlockHash(), stats);
+}
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* block_index, CoinStatsRecord& stats) const
+{
+    if (block_index->nHeight == 0) {
+        stats = CoinStatsRecord();
+        MuHash3072().Finalize(stats.hashMuHash.begin());
+        return true;
+    }
+    return m_db->ReadStats(block_index->GetBlockHash(), stats);
+}
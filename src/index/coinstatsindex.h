@@ -0,0 +1,54 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <index/base.h>
+#include <streams.h>
+#include <txdb.h>
+
+class CScript;
+
+/** The bogosize of a coin with the given output script, as in gettxoutsetinfo. */
+uint64_t GetBogoSize(const CScript& scriptPubKey);
+
+/** Serialize a coin the way the MuHash of the UTXO set commits to it. */
+CDataStream TxOutSer(const COutPoint& outpoint, const Coin& coin);
+
+/**
+ * CoinStatsIndex records statistics about the UTXO set as of every block:
+ * the number of outputs, their total amount, their bogosize and a MuHash of
+ * the set. The statistics of a block are derived from those of its parent and
+ * the coins the block creates and spends, so they never require a scan of the
+ * chainstate and remain available for blocks that have since been reorged out.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+private:
+    const std::unique_ptr<CoinStatsIndexDB> m_db;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndexDB& GetDB() const override { return *m_db; }
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the CoinStatsIndex, which becomes available to be queried.
+    explicit CoinStatsIndex(std::unique_ptr<CoinStatsIndexDB> db);
+
+    /// Destructor interrupts sync thread if running and blocks until it exits.
+    ~CoinStatsIndex() override;
+
+    /// Look up the statistics of the UTXO set as of the given block.
+    /// @return  false if the block has not been indexed
+    bool LookUpStats(const CBlockIndex* block_index, CoinStatsRecord& stats) const;
+};
+
+/// The global UTXO set statistics index, used in gettxoutsetinfo. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coinstatsindex;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
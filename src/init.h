@@ -17,6 +17,8 @@ class thread_group;
 } // namespace boost
 
 void StartShutdown();
+//! Clear a shutdown request, e.g. one made by a test
+void AbortShutdown();
 bool ShutdownRequested();
 /** Interrupt threads */
 void Interrupt();
@@ -71,13 +71,28 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // The part of the compaction this state is for: user keys in (start, end],
+  // where a missing bound means no bound.
+  bool has_start;
+  bool has_end;
+  std::string start;
+  std::string end;
+  Compaction::KeyState key_state;
+  Status status;
+
+  // States of the other parts, if the compaction is split.  Only the state
+  // of the first part has any, and owns them.
+  std::vector<CompactionState*> parts;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        has_start(false),
+        has_end(false) {
   }
 };
 
@@ -98,6 +113,7 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -126,6 +142,10 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       db_lock_(NULL),
       shutting_down_(NULL),
       bg_cv_(&mutex_),
+      compaction_cv_(&mutex_),
+      subcompactions_running_(0),
+      subcompaction_cv_(&mutex_),
+      subcompaction_threads_(0),
       mem_(NULL),
       imm_(NULL),
       logfile_(NULL),
@@ -152,6 +172,10 @@ DBImpl::~DBImpl() {
   while (bg_compaction_scheduled_) {
     bg_cv_.Wait();
   }
+  subcompaction_cv_.SignalAll();
+  while (subcompaction_threads_ > 0) {
+    bg_cv_.Wait();
+  }
   mutex_.Unlock();
 
   if (db_lock_ != NULL) {
@@ -770,6 +794,9 @@ void DBImpl::BackgroundCompaction() {
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
   mutex_.AssertHeld();
+  for (size_t i = 0; i < compact->parts.size(); i++) {
+    CleanupCompaction(compact->parts[i]);
+  }
   if (compact->builder != NULL) {
     // May happen if we get a shutdown call in the middle of compaction
     compact->builder->Abandon();
@@ -865,21 +892,29 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
 
 Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   mutex_.AssertHeld();
+  std::vector<CompactionState*> parts(1, compact);
+  parts.insert(parts.end(), compact->parts.begin(), compact->parts.end());
+  uint64_t total_bytes = 0;
+  for (size_t p = 0; p < parts.size(); p++) {
+    total_bytes += parts[p]->total_bytes;
+  }
   Log(options_.info_log,  "Compacted %d@%d + %d@%d files => %lld bytes",
       compact->compaction->num_input_files(0),
       compact->compaction->level(),
       compact->compaction->num_input_files(1),
       compact->compaction->level() + 1,
-      static_cast<long long>(compact->total_bytes));
+      static_cast<long long>(total_bytes));
 
   // Add compaction outputs
   compact->compaction->AddInputDeletions(compact->compaction->edit());
   const int level = compact->compaction->level();
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    const CompactionState::Output& out = compact->outputs[i];
-    compact->compaction->edit()->AddFile(
-        level + 1,
-        out.number, out.file_size, out.smallest, out.largest);
+  for (size_t p = 0; p < parts.size(); p++) {
+    for (size_t i = 0; i < parts[p]->outputs.size(); i++) {
+      const CompactionState::Output& out = parts[p]->outputs[i];
+      compact->compaction->edit()->AddFile(
+          level + 1,
+          out.number, out.file_size, out.smallest, out.largest);
+    }
   }
   return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
 }
@@ -903,19 +938,138 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
 
+  // Split the key range into parts, each processed by its own thread.  This
+  // thread does the first part.
+  std::vector<std::string> boundaries;
+  compact->compaction->GetSplitPoints(options_.max_subcompactions, &boundaries);
+  for (size_t i = 0; i < boundaries.size(); i++) {
+    CompactionState* part = new CompactionState(compact->compaction);
+    part->smallest_snapshot = compact->smallest_snapshot;
+    part->has_start = true;
+    part->start = boundaries[i];
+    if (i + 1 < boundaries.size()) {
+      part->has_end = true;
+      part->end = boundaries[i + 1];
+    }
+    compact->parts.push_back(part);
+  }
+  if (!boundaries.empty()) {
+    compact->has_end = true;
+    compact->end = boundaries[0];
+    Log(options_.info_log, "Compacting in %d parts",
+        static_cast<int>(boundaries.size()) + 1);
+  }
+  subcompactions_running_ = static_cast<int>(compact->parts.size());
+  for (size_t i = 0; i < compact->parts.size(); i++) {
+    subcompaction_queue_.push_back(compact->parts[i]);
+  }
+  while (subcompaction_threads_ < subcompactions_running_) {
+    subcompaction_threads_++;
+    env_->StartThread(&DBImpl::SubcompactionWork, this);
+  }
+  subcompaction_cv_.SignalAll();
+
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
+  Status status = DoCompactionRange(compact, &imm_micros);
+
+  mutex_.Lock();
+  while (subcompactions_running_ > 0) {
+    // Keep prioritizing immutable compaction work until all parts are done
+    if (imm_ != NULL) {
+      const uint64_t imm_start = env_->NowMicros();
+      CompactMemTable();
+      bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+      imm_micros += (env_->NowMicros() - imm_start);
+    } else {
+      compaction_cv_.Wait();
+    }
+  }
+  for (size_t i = 0; i < compact->parts.size(); i++) {
+    if (status.ok()) {
+      status = compact->parts[i]->status;
+    }
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  for (size_t i = 0; i < compact->parts.size(); i++) {
+    for (size_t j = 0; j < compact->parts[i]->outputs.size(); j++) {
+      stats.bytes_written += compact->parts[i]->outputs[j].file_size;
+    }
+  }
+
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+void DBImpl::SubcompactionWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->SubcompactionCall();
+}
+
+void DBImpl::SubcompactionCall() {
+  MutexLock l(&mutex_);
+  while (true) {
+    while (subcompaction_queue_.empty() && !shutting_down_.Acquire_Load()) {
+      subcompaction_cv_.Wait();
+    }
+    if (subcompaction_queue_.empty()) {
+      break;
+    }
+    CompactionState* part = subcompaction_queue_.front();
+    subcompaction_queue_.pop_front();
+    mutex_.Unlock();
+    part->status = DoCompactionRange(part, NULL);
+    mutex_.Lock();
+    subcompactions_running_--;
+    compaction_cv_.SignalAll();
+  }
+  subcompaction_threads_--;
+  bg_cv_.SignalAll();
+}
+
+Status DBImpl::DoCompactionRange(CompactionState* compact,
+                                 int64_t* imm_micros) {
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
-  Status status;
   ParsedInternalKey ikey;
+  if (compact->has_start) {
+    // Skip the entries for the start key, which belong to the previous part
+    InternalKey start(compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
+    while (input->Valid() && ParseInternalKey(input->key(), &ikey) &&
+           user_comparator()->Compare(ikey.user_key,
+                                      Slice(compact->start)) <= 0) {
+      input->Next();
+    }
+  } else {
+    input->SeekToFirst();
+  }
+  Status status;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
+    if (imm_micros != NULL && has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
       if (imm_ != NULL) {
@@ -923,11 +1077,16 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      *imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->has_end && ParseInternalKey(key, &ikey) &&
+        user_comparator()->Compare(ikey.user_key, Slice(compact->end)) > 0) {
+      // The rest belongs to the next part
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->key_state) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -957,7 +1116,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        &compact->key_state)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -970,15 +1130,6 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
       last_sequence_for_key = ikey.sequence;
     }
-#if 0
-    Log(options_.info_log,
-        "  Compact: %s, seq %d, type: %d %d, drop: %d, is_base: %d, "
-        "%d smallest_snapshot: %d",
-        ikey.user_key.ToString().c_str(),
-        (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
-        (int)last_sequence_for_key, (int)compact->smallest_snapshot);
-#endif
 
     if (!drop) {
       // Open output file if necessary
@@ -1017,31 +1168,6 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = NULL;
-
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
-  }
-
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
-
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
-  }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
   return status;
 }
 
@@ -1334,10 +1460,13 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // individual write by 1ms to reduce latency variance.  Also,
       // this delay hands over some CPU to the compaction thread in
       // case it is sharing the same core as the writer.
+      const uint64_t start = env_->NowMicros();
       mutex_.Unlock();
       env_->SleepForMicroseconds(1000);
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();
+      stall_stats_.slowdowns++;
+      stall_stats_.slowdown_micros += env_->NowMicros() - start;
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
@@ -1346,11 +1475,17 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
+      stall_stats_.memtable_waits++;
+      stall_stats_.memtable_micros += env_->NowMicros() - start;
     } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
+      stall_stats_.level0_waits++;
+      stall_stats_.level0_micros += env_->NowMicros() - start;
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
@@ -1372,6 +1507,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
       force = false;   // Do not force another compaction if have room
+      compaction_cv_.SignalAll();
       MaybeScheduleCompaction();
     }
   }
@@ -1440,6 +1576,20 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
              static_cast<unsigned long long>(total_usage));
     value->append(buf);
     return true;
+  } else if (in == "writestalls") {
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "slowdowns %llu %llu\n"
+             "memtable-waits %llu %llu\n"
+             "level0-waits %llu %llu\n",
+             static_cast<unsigned long long>(stall_stats_.slowdowns),
+             static_cast<unsigned long long>(stall_stats_.slowdown_micros),
+             static_cast<unsigned long long>(stall_stats_.memtable_waits),
+             static_cast<unsigned long long>(stall_stats_.memtable_micros),
+             static_cast<unsigned long long>(stall_stats_.level0_waits),
+             static_cast<unsigned long long>(stall_stats_.level0_micros));
+    value->append(buf);
+    return true;
   }
 
   return false;
@@ -112,6 +112,14 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Compact the key range of one part of a compaction, without holding
+  // mutex_.  Memtable compactions are done in between if imm_micros is
+  // non-NULL, and the time spent on them added to it.
+  Status DoCompactionRange(CompactionState* compact, int64_t* imm_micros);
+  // Threads for the other parts of compactions, started as needed and kept
+  // until the DB is closed.
+  static void SubcompactionWork(void* db);
+  void SubcompactionCall();
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -137,6 +145,13 @@ class DBImpl : public DB {
   port::Mutex mutex_;
   port::AtomicPointer shutting_down_;
   port::CondVar bg_cv_;          // Signalled when background work finishes
+  port::CondVar compaction_cv_;  // Signalled when a part of a compaction
+                                 // finishes, or imm_ is set
+  int subcompactions_running_;
+  port::CondVar subcompaction_cv_;  // Signalled when parts are queued, or
+                                    // on shutdown
+  std::deque<CompactionState*> subcompaction_queue_;
+  int subcompaction_threads_;
   MemTable* mem_;
   MemTable* imm_;                // Memtable being compacted
   port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
@@ -190,6 +205,22 @@ class DBImpl : public DB {
   };
   CompactionStats stats_[config::kNumLevels];
 
+  // Writes held up in MakeRoomForWrite() because compactions fell behind.
+  struct WriteStallStats {
+    uint64_t slowdowns;         // Writes delayed by 1ms for many L0 files
+    uint64_t slowdown_micros;
+    uint64_t memtable_waits;    // Waits for the previous memtable to be written
+    uint64_t memtable_micros;
+    uint64_t level0_waits;      // Waits for too many L0 files to be compacted
+    uint64_t level0_micros;
+
+    WriteStallStats()
+        : slowdowns(0), slowdown_micros(0),
+          memtable_waits(0), memtable_micros(0),
+          level0_waits(0), level0_micros(0) { }
+  };
+  WriteStallStats stall_stats_;
+
   // No copying allowed
   DBImpl(const DBImpl&);
   void operator=(const DBImpl&);
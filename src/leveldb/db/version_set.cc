@@ -1448,12 +1448,15 @@ Compaction* VersionSet::CompactRange(
 Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      input_version_(NULL) {
+}
+
+Compaction::KeyState::KeyState()
+    : grandparent_index(0),
+      seen_key(false),
+      overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
@@ -1481,13 +1484,14 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key,
+                                   KeyState* state) const {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; state->level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[state->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1496,35 +1500,81 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      state->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  KeyState* state) const {
   const VersionSet* vset = input_version_->vset_;
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &vset->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
+  while (state->grandparent_index < grandparents_.size() &&
       icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+                    grandparents_[state->grandparent_index]->largest.Encode()) > 0) {
+    if (state->seen_key) {
+      state->overlapped_bytes += grandparents_[state->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    state->grandparent_index++;
   }
-  seen_key_ = true;
+  state->seen_key = true;
 
-  if (overlapped_bytes_ > MaxGrandParentOverlapBytes(vset->options_)) {
+  if (state->overlapped_bytes > MaxGrandParentOverlapBytes(vset->options_)) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    state->overlapped_bytes = 0;
     return true;
   } else {
     return false;
   }
 }
 
+void Compaction::GetSplitPoints(int max_parts,
+                                std::vector<std::string>* boundaries) const {
+  boundaries->clear();
+  const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
+  // Parts of less than an output file are not worth a thread.
+  uint64_t total_bytes = 0;
+  std::vector<Slice> keys;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      total_bytes += inputs_[which][i]->file_size;
+      keys.push_back(inputs_[which][i]->largest.user_key());
+    }
+  }
+  const uint64_t parts_by_size = total_bytes / max_output_file_size_;
+  if (parts_by_size < static_cast<uint64_t>(max_parts)) {
+    max_parts = static_cast<int>(parts_by_size);
+  }
+  if (max_parts <= 1 || keys.size() < 2) {
+    return;
+  }
+
+  struct SliceLess {
+    const Comparator* cmp;
+    bool operator()(const Slice& a, const Slice& b) const {
+      return cmp->Compare(a, b) < 0;
+    }
+  } less = {user_cmp};
+  std::sort(keys.begin(), keys.end(), less);
+  // The largest key ends the last part, and cannot split.
+  const Slice largest = keys.back();
+  while (!keys.empty() && user_cmp->Compare(keys.back(), largest) == 0) {
+    keys.pop_back();
+  }
+  if (keys.empty()) {
+    return;
+  }
+  const size_t num_parts = std::min<size_t>(max_parts, keys.size() + 1);
+  for (size_t i = 1; i < num_parts; i++) {
+    const Slice& key = keys[i * keys.size() / num_parts];
+    if (boundaries->empty() || user_cmp->Compare(key, boundaries->back()) > 0) {
+      boundaries->push_back(key.ToString());
+    }
+  }
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
     input_version_->Unref();
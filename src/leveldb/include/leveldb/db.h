@@ -117,6 +117,9 @@ class DB {
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.writestalls" - returns one line each for the writes slowed
+  //     down by 1ms, the waits for a memtable to be written and the waits
+  //     for level-0 compactions, with the count and the total microseconds.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
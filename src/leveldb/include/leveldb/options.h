@@ -27,6 +27,10 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+// Returns whether this build can compress blocks with kSnappyCompression.
+// Without snappy, blocks are stored uncompressed whatever the option says.
+extern bool SnappyCompressionSupported();
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct Options {
   // -------------------
@@ -153,6 +157,14 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // Compactions are split by key range into up to this many parts, which
+  // are processed by as many threads at once.  Values above 1 let writes
+  // that wait for compactions, like a burst that fills level-0, resume
+  // sooner on machines with idle cores.
+  //
+  // Default: 1
+  int max_subcompactions;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -6,6 +6,7 @@
 
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
+#include "port/port.h"
 
 namespace leveldb {
 
@@ -24,7 +25,13 @@ Options::Options()
       max_file_size(2<<20),
       compression(kSnappyCompression),
       reuse_logs(false),
-      filter_policy(NULL) {
+      filter_policy(NULL),
+      max_subcompactions(1) {
+}
+
+bool SnappyCompressionSupported() {
+  std::string compressed;
+  return port::Snappy_Compress("", 0, &compressed);
 }
 
 }  // namespace leveldb
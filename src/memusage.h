@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
@@ -164,6 +165,20 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+/**
+ * A map allocating from a PoolResource of its own. All the chunks of the pool
+ * are counted, including the memory of erased nodes that the pool keeps for
+ * reuse, and so is a bucket array small enough to be pooled; larger bucket
+ * arrays are heap allocations.
+ */
+template<typename X, typename Y, typename Z, typename P, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    const auto* resource = m.get_allocator().resource();
+    const size_t nBucketBytes = sizeof(void*) * m.bucket_count();
+    return resource->NumAllocatedChunks() * MallocUsage(resource->ChunkSizeBytes()) + (nBucketBytes > MAX_BLOCK_SIZE_BYTES ? MallocUsage(nBucketBytes) : 0);
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
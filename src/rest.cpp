@@ -6,6 +6,7 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <core_io.h>
+#include <index/txindex.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <validation.h>
@@ -208,6 +209,9 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // The binary and hex formats are served from the block as stored on
+    // disk, unless witness data has to be stripped from it.
+    const bool fRaw = rf == RF_BINARY || rf == RF_HEX;
     CBlock block;
     CBlockIndex* pblockindex = nullptr;
     {
@@ -219,12 +223,22 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        if (!fRaw && !ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    if (fRaw) {
+        std::shared_ptr<const std::vector<unsigned char>> pblockRaw;
+        if (!ReadRawBlockFromDisk(pblockRaw, pblockindex, Params().MessageStart()))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        if ((RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS) && RawBlockHasWitness(*pblockRaw)) {
+            CDataStream(*pblockRaw, SER_NETWORK, PROTOCOL_VERSION) >> block;
+            ssBlock << block;
+        } else {
+            ssBlock.write((const char*)pblockRaw->data(), pblockRaw->size());
+        }
+    }
 
     switch (rf) {
     case RF_BINARY: {
@@ -350,6 +364,10 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    if (g_txindex) {
+        g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     CTransactionRef tx;
     uint256 hashBlock = uint256();
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
@@ -6,17 +6,21 @@
 #include <rpc/blockchain.h>
 
 #include <amount.h>
+#include <base58.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
 #include <consensus/validation.h>
+#include <crypto/muhash.h>
 #include <validation.h>
 #include <core_io.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
+#include <random.h>
 #include <rpc/server.h>
+#include <script/standard.h>
 #include <streams.h>
 #include <sync.h>
 #include <txdb.h>
@@ -24,6 +28,8 @@
 #include <util.h>
 #include <utilstrencodings.h>
 #include <hash.h>
+#include <init.h>
+#include <index/coinstatsindex.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
@@ -33,7 +39,9 @@
 
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
+#include <future>
 #include <mutex>
+#include <unordered_set>
 #include <condition_variable>
 
 struct CUpdatedBlock
@@ -812,13 +820,21 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nBogoSize;
     uint256 hashSerialized;
+    uint256 hashMuHash;
     uint64_t nDiskSize;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
 };
 
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+enum class CoinStatsHashType {
+    HASH_SERIALIZED,
+    MUHASH,
+    NONE,
+};
+
+template <typename Stream>
+static void ApplyStats(CCoinsStats &stats, Stream& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
     assert(!outputs.empty());
     ss << hash;
@@ -830,46 +846,206 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
         ss << VARINT(output.second.out.nValue);
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
     }
     ss << VARINT(0);
 }
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Accumulate the statistics of the coins in the range of a cursor, and
+//! optionally their MuHash. Run concurrently for disjoint ranges of txids.
+static bool GetUTXOStatsRange(CCoinsViewCursor& cursor, CCoinsStats& stats, MuHash3072* muhash)
 {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    uint256 prevkey;
+    for (; cursor.Valid(); cursor.Next()) {
+        if (ShutdownRequested()) {
+            return false;
+        }
+        COutPoint key;
+        Coin coin;
+        if (!cursor.GetKey(key) || !cursor.GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        if (stats.nTransactions == 0 || key.hash != prevkey) {
+            stats.nTransactions++;
+            prevkey = key.hash;
+        }
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += coin.out.nValue;
+        stats.nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+        if (muhash) {
+            const CDataStream ss = TxOutSer(key, coin);
+            muhash->Insert(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+        }
     }
-    ss << stats.hashBlock;
+    return true;
+}
+
+/** Number of txid ranges hash_serialized_2 is computed over. */
+static const unsigned int UTXO_STATS_SERIALIZED_PARTS = 4096;
+/** Ranges per thread that may be serialized ahead of the one being hashed. */
+static const unsigned int UTXO_STATS_SERIALIZED_AHEAD = 4;
+
+//! Accumulate the statistics of the coins in the range of a cursor, and
+//! serialize them as hash_serialized_2 commits to them. Run concurrently for
+//! disjoint ranges of txids.
+static bool SerializeUTXOStatsRange(CCoinsViewCursor& cursor, CCoinsStats& stats, std::vector<unsigned char>& vchSerialized)
+{
+    CVectorWriter ss(SER_GETHASH, PROTOCOL_VERSION, vchSerialized, 0);
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+    for (; cursor.Valid(); cursor.Next()) {
+        if (ShutdownRequested()) {
+            return false;
+        }
         COutPoint key;
         Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
+        if (!cursor.GetKey(key) || !cursor.GetValue(coin)) {
             return error("%s: unable to read value", __func__);
         }
-        pcursor->Next();
+        if (!outputs.empty() && key.hash != prevkey) {
+            ApplyStats(stats, ss, prevkey, outputs);
+            outputs.clear();
+        }
+        prevkey = key.hash;
+        outputs[key.n] = std::move(coin);
     }
     if (!outputs.empty()) {
         ApplyStats(stats, ss, prevkey, outputs);
     }
+    return true;
+}
+
+static bool SetUTXOStatsHeight(CCoinsStats& stats)
+{
+    LOCK(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+    if (it == mapBlockIndex.end()) {
+        return error("%s: unknown best block %s", __func__, stats.hashBlock.ToString());
+    }
+    stats.nHeight = it->second->nHeight;
+    return true;
+}
+
+/**
+ * Calculate statistics about the unspent transaction output set.
+ *
+ * The set is split into ranges of txids that are scanned by one thread per
+ * core, and the partial results are merged. For MuHash and no hash, there is
+ * one range per thread: the counts add up and MuHash is independent of the
+ * order of the coins. hash_serialized_2 commits to the coins in order, so the
+ * threads only read and serialize small ranges, a bounded number ahead, and
+ * the serialized ranges are hashed in order on the calling thread.
+ */
+static bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, CoinStatsHashType hash_type)
+{
+    if (hash_type != CoinStatsHashType::HASH_SERIALIZED) {
+        const unsigned int nParts = std::max(1, GetNumCores());
+        std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = view->Cursors(nParts);
+        stats.hashBlock = cursors.front()->GetBestBlock();
+        if (!SetUTXOStatsHeight(stats)) {
+            return false;
+        }
+
+        std::vector<CCoinsStats> parts(nParts);
+        std::vector<MuHash3072> muhashes(nParts);
+        std::vector<std::future<bool>> results;
+        for (unsigned int i = 0; i < nParts; i++) {
+            results.push_back(std::async(std::launch::async, GetUTXOStatsRange, std::ref(*cursors[i]), std::ref(parts[i]),
+                                         hash_type == CoinStatsHashType::MUHASH ? &muhashes[i] : nullptr));
+        }
+        bool fOk = true;
+        for (std::future<bool>& result : results) {
+            fOk &= result.get();
+        }
+        if (!fOk) {
+            return false;
+        }
+
+        MuHash3072 muhash;
+        for (unsigned int i = 0; i < nParts; i++) {
+            stats.nTransactions += parts[i].nTransactions;
+            stats.nTransactionOutputs += parts[i].nTransactionOutputs;
+            stats.nTotalAmount += parts[i].nTotalAmount;
+            stats.nBogoSize += parts[i].nBogoSize;
+            muhash *= muhashes[i];
+        }
+        if (hash_type == CoinStatsHashType::MUHASH) {
+            muhash.Finalize(stats.hashMuHash.begin());
+        }
+        stats.nDiskSize = view->EstimateSize();
+        return true;
+    }
+
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = view->Cursors(UTXO_STATS_SERIALIZED_PARTS);
+    stats.hashBlock = cursors.front()->GetBestBlock();
+    if (!SetUTXOStatsHeight(stats)) {
+        return false;
+    }
+
+    const size_t nThreads = std::max(1, GetNumCores());
+    const size_t nAhead = nThreads * UTXO_STATS_SERIALIZED_AHEAD;
+    std::vector<CCoinsStats> parts(cursors.size());
+    std::vector<std::vector<unsigned char>> vSerialized(cursors.size());
+    std::vector<bool> vDone(cursors.size());
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t nNext = 0;
+    size_t nHashed = 0;
+    bool fFailed = false;
+
+    auto worker = [&] {
+        while (true) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return fFailed || nNext >= cursors.size() || nNext < nHashed + nAhead; });
+                if (fFailed || nNext >= cursors.size()) {
+                    return;
+                }
+                i = nNext++;
+            }
+            const bool fOk = SerializeUTXOStatsRange(*cursors[i], parts[i], vSerialized[i]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fFailed |= !fOk;
+                vDone[i] = true;
+            }
+            cond.notify_all();
+        }
+    };
+    std::vector<std::future<void>> threads;
+    for (size_t i = 0; i < nThreads; i++) {
+        threads.push_back(std::async(std::launch::async, worker));
+    }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    for (size_t i = 0; i < cursors.size(); i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return fFailed || vDone[i]; });
+            if (fFailed) {
+                break;
+            }
+        }
+        ss.write((const char*)vSerialized[i].data(), vSerialized[i].size());
+        std::vector<unsigned char>().swap(vSerialized[i]);
+        stats.nTransactions += parts[i].nTransactions;
+        stats.nTransactionOutputs += parts[i].nTransactionOutputs;
+        stats.nTotalAmount += parts[i].nTotalAmount;
+        stats.nBogoSize += parts[i].nBogoSize;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nHashed++;
+        }
+        cond.notify_all();
+    }
+    for (std::future<void>& thread : threads) {
+        thread.get();
+    }
+    if (fFailed) {
+        return false;
+    }
     stats.hashSerialized = ss.GetHash();
     stats.nDiskSize = view->EstimateSize();
     return true;
@@ -924,40 +1100,122 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(height);
 }
 
+static const CBlockIndex* ParseHashOrHeight(const UniValue& param)
+{
+    AssertLockHeld(cs_main);
+
+    if (param.isNum()) {
+        const int height = param.get_int();
+        if (height < 0 || height > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is out of range", height));
+        }
+        return chainActive[height];
+    }
+    const uint256 hash = ParseHashV(param, "hash_or_height");
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    if (it == mapBlockIndex.end()) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    }
+    return it->second;
+}
+
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( hash_or_height \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless -coinstatsindex is enabled and hash_type is not hash_serialized_2.\n"
+            "\nArguments:\n"
+            "1. hash_or_height     (string or numeric, optional) The block hash or height to return statistics for,\n"
+            "                      instead of the chain tip. Requires -coinstatsindex.\n"
+            "2. \"hash_type\"        (string, optional) Which UTXO set hash to calculate: \"hash_serialized_2\", \"muhash\" or \"none\".\n"
+            "                      Defaults to \"muhash\" with -coinstatsindex and to \"hash_serialized_2\" otherwise.\n"
+            "                      Without the index, \"muhash\" and \"none\" scan the UTXO set on all cores.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (not available from -coinstatsindex)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only for hash_type hash_serialized_2)\n"
+            "  \"muhash\": \"hash\",      (string) The order independent MuHash of the set (only for hash_type muhash)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (only for the chain tip)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "1000")
+            + HelpExampleCli("gettxoutsetinfo", "null muhash")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    CoinStatsHashType hash_type = g_coinstatsindex ? CoinStatsHashType::MUHASH : CoinStatsHashType::HASH_SERIALIZED;
+    if (!request.params[1].isNull()) {
+        const std::string& strHashType = request.params[1].get_str();
+        if (strHashType == "hash_serialized_2") {
+            hash_type = CoinStatsHashType::HASH_SERIALIZED;
+        } else if (strHashType == "muhash") {
+            hash_type = CoinStatsHashType::MUHASH;
+        } else if (strHashType == "none") {
+            hash_type = CoinStatsHashType::NONE;
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", strHashType));
+        }
+    }
+
+    if (g_coinstatsindex && hash_type != CoinStatsHashType::HASH_SERIALIZED) {
+        g_coinstatsindex->BlockUntilSyncedToCurrentChain();
+
+        const CBlockIndex* pindex;
+        bool fTip;
+        {
+            LOCK(cs_main);
+            pindex = request.params[0].isNull() ? chainActive.Tip() : ParseHashOrHeight(request.params[0]);
+            fTip = pindex == chainActive.Tip();
+        }
+        CoinStatsRecord stats;
+        if (g_coinstatsindex->LookUpStats(pindex, stats)) {
+            ret.pushKV("height", (int64_t)pindex->nHeight);
+            ret.pushKV("bestblock", pindex->GetBlockHash().GetHex());
+            ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+            ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+            if (hash_type == CoinStatsHashType::MUHASH) {
+                ret.pushKV("muhash", stats.hashMuHash.GetHex());
+            }
+            if (fTip) {
+                ret.pushKV("disk_size", pcoinsdbview->EstimateSize());
+            }
+            ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+            return ret;
+        }
+        if (!request.params[0].isNull()) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Statistics for the block are not available, the coin stats index may still be syncing");
+        }
+        // Fall back to scanning the chainstate until the index has caught up.
+    } else if (!request.params[0].isNull()) {
+        if (g_coinstatsindex) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "hash_serialized_2 cannot be queried for a specific block");
+        }
+        throw JSONRPCError(RPC_MISC_ERROR, "Querying statistics for a specific block requires -coinstatsindex");
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStats(pcoinsdbview.get(), stats, hash_type)) {
         ret.pushKV("height", (int64_t)stats.nHeight);
         ret.pushKV("bestblock", stats.hashBlock.GetHex());
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
         ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
-        ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+            ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        } else if (hash_type == CoinStatsHashType::MUHASH) {
+            ret.pushKV("muhash", stats.hashMuHash.GetHex());
+        }
         ret.pushKV("disk_size", stats.nDiskSize);
         ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     } else {
@@ -1308,7 +1566,7 @@ UniValue getchaintips(const JSONRPCRequest& request)
     std::set<const CBlockIndex*> setOrphans;
     std::set<const CBlockIndex*> setPrevs;
 
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (const BlockMap::value_type& item : mapBlockIndex)
     {
         if (!chainActive.Contains(item.second)) {
             setOrphans.insert(item.second);
@@ -1615,6 +1873,361 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the chain tip to a snapshot file.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) path to the output file, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,     (numeric) the number of coins written\n"
+            "  \"base_hash\": \"hash\",   (string) the hash of the block the snapshot was taken at\n"
+            "  \"base_height\": n,       (numeric) the height of that block\n"
+            "  \"path\": \"path\"         (string) the absolute path of the written file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+    }
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    CValidationState state;
+    uint256 hashBlock;
+    uint64_t nCoins;
+    if (!DumpUTXOSnapshot(path, state, hashBlock, nCoins)) {
+        throw JSONRPCError(RPC_MISC_ERROR, state.GetRejectReason());
+    }
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_written", nCoins);
+    ret.pushKV("base_hash", hashBlock.GetHex());
+    ret.pushKV("base_height", mapBlockIndex.find(hashBlock)->second->nHeight);
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "loadtxoutset \"path\"\n"
+            "\nLoad a snapshot written by dumptxoutset and make its block the chain tip.\n"
+            "The node must be pruned and must not have connected any block yet. Blocks below\n"
+            "the snapshot are treated as pruned and are not downloaded.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) path to the snapshot file, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,      (numeric) the number of coins loaded\n"
+            "  \"base_hash\": \"hash\",   (string) the hash of the block the snapshot was taken at\n"
+            "  \"base_height\": n        (numeric) the height of that block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+    }
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+
+    CValidationState state;
+    uint256 hashBlock;
+    uint64_t nCoins;
+    if (!LoadUTXOSnapshot(path, state, Params(), hashBlock, nCoins)) {
+        throw JSONRPCError(RPC_MISC_ERROR, state.GetRejectReason());
+    }
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_loaded", nCoins);
+    ret.pushKV("base_hash", hashBlock.GetHex());
+    ret.pushKV("base_height", mapBlockIndex.find(hashBlock)->second->nHeight);
+    return ret;
+}
+
+/** Number of txid ranges scantxoutset splits the UTXO set into. */
+static const unsigned int SCAN_TXOUTSET_PARTS = 256;
+
+static std::atomic<bool> g_scan_in_progress{false};
+static std::atomic<bool> g_should_abort_scan{false};
+static std::atomic<unsigned int> g_scan_parts_done{0};
+
+/** RAII object allowing only one scantxoutset at a time. */
+class CoinsViewScanReserver
+{
+private:
+    bool m_could_reserve;
+public:
+    explicit CoinsViewScanReserver() : m_could_reserve(false) {}
+
+    bool reserve() {
+        assert(!m_could_reserve);
+        bool expected = false;
+        if (!g_scan_in_progress.compare_exchange_strong(expected, true)) {
+            return false;
+        }
+        m_could_reserve = true;
+        return true;
+    }
+
+    ~CoinsViewScanReserver() {
+        if (m_could_reserve) {
+            g_scan_in_progress = false;
+        }
+    }
+};
+
+/** Salted hasher for sets of scriptPubKeys. */
+class SaltedScriptHasher
+{
+private:
+    const uint64_t k0, k1;
+public:
+    SaltedScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CScript& script) const {
+        return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+    }
+};
+
+typedef std::unordered_set<CScript, SaltedScriptHasher> ScriptSet;
+
+/**
+ * Search the UTXO set for outputs paying to any of the given scripts. The
+ * cursors are handed out to a pool of threads, one at a time, so the work
+ * stays balanced however the coins are spread over the ranges. The outputs
+ * found are returned in the order of the cursors.
+ * @return false if the scan was aborted or a coin could not be read
+ */
+static bool FindScriptPubKeys(std::vector<std::unique_ptr<CCoinsViewCursor>>& cursors, const ScriptSet& needles,
+                              std::vector<std::pair<COutPoint, Coin>>& found, uint64_t& nSearchedItems)
+{
+    std::vector<std::vector<std::pair<COutPoint, Coin>>> vFound(cursors.size());
+    std::atomic<size_t> nNext{0};
+    std::atomic<uint64_t> nSearched{0};
+    std::atomic<bool> fFailed{false};
+
+    auto worker = [&] {
+        for (size_t i = nNext++; i < cursors.size(); i = nNext++) {
+            CCoinsViewCursor& cursor = *cursors[i];
+            uint64_t nCount = 0;
+            for (; cursor.Valid(); cursor.Next(), nCount++) {
+                if (fFailed || g_should_abort_scan || ShutdownRequested()) {
+                    fFailed = true;
+                    break;
+                }
+                COutPoint key;
+                Coin coin;
+                if (!cursor.GetKey(key) || !cursor.GetValue(coin)) {
+                    error("%s: unable to read value", __func__);
+                    fFailed = true;
+                    break;
+                }
+                if (needles.count(coin.out.scriptPubKey)) {
+                    vFound[i].emplace_back(key, std::move(coin));
+                }
+            }
+            nSearched += nCount;
+            if (fFailed) {
+                return;
+            }
+            ++g_scan_parts_done;
+        }
+    };
+
+    const size_t nThreads = std::min<size_t>(cursors.size(), std::max(1, GetNumCores()));
+    std::vector<std::future<void>> threads;
+    for (size_t i = 0; i < nThreads; i++) {
+        threads.push_back(std::async(std::launch::async, worker));
+    }
+    for (std::future<void>& thread : threads) {
+        thread.get();
+    }
+
+    for (std::vector<std::pair<COutPoint, Coin>>& part : vFound) {
+        std::move(part.begin(), part.end(), std::back_inserter(found));
+    }
+    nSearchedItems = nSearched;
+    return !fFailed;
+}
+
+/** Add the scripts an object of the scantxoutset scanobjects argument refers to. */
+static void AddScanObjectScripts(const UniValue& scanobject, ScriptSet& needles)
+{
+    if (scanobject.isStr() || (scanobject.isObject() && scanobject.exists("address"))) {
+        const std::string& strAddress = scanobject.isStr() ? scanobject.get_str() : find_value(scanobject, "address").get_str();
+        const CTxDestination dest = DecodeDestination(strAddress);
+        if (!IsValidDestination(dest)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + strAddress);
+        }
+        needles.insert(GetScriptForDestination(dest));
+    } else if (scanobject.isObject() && scanobject.exists("script")) {
+        const std::string& strScript = find_value(scanobject, "script").get_str();
+        if (!IsHex(strScript)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Script must be hexadecimal: " + strScript);
+        }
+        const std::vector<unsigned char> script = ParseHex(strScript);
+        needles.emplace(script.begin(), script.end());
+    } else if (scanobject.isObject() && scanobject.exists("pubkey")) {
+        const std::string& strPubKey = find_value(scanobject, "pubkey").get_str();
+        const CPubKey pubkey(ParseHex(strPubKey));
+        if (!IsHex(strPubKey) || !pubkey.IsFullyValid()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid public key: " + strPubKey);
+        }
+        needles.insert(GetScriptForRawPubKey(pubkey));
+        needles.insert(GetScriptForDestination(pubkey.GetID()));
+        // Witness outputs are only standard for compressed keys.
+        if (pubkey.IsCompressed()) {
+            const CScript witness_script = GetScriptForDestination(WitnessV0KeyHash(pubkey.GetID()));
+            needles.insert(witness_script);
+            needles.insert(GetScriptForDestination(CScriptID(witness_script)));
+        }
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid scan object");
+    }
+}
+
+UniValue scantxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "scantxoutset \"action\" ( [scanobjects,...] )\n"
+            "\nScans the unspent transaction output set for outputs paying to the given addresses, scripts or public keys.\n"
+            "The scan runs on all cores, without holding any lock. Only one scan can run at a time.\n"
+            "\nArguments:\n"
+            "1. \"action\"                       (string, required) The action to execute\n"
+            "                                      \"start\" for starting a scan\n"
+            "                                      \"abort\" for aborting the current scan (returns true when abort was successful)\n"
+            "                                      \"status\" for progress report (in %) of the current scan\n"
+            "2. \"scanobjects\"                  (array, required for \"start\") Array of scan objects\n"
+            "    [                               Every scan object is either a string address or an object:\n"
+            "      \"address\",                  (string) An address\n"
+            "      { \"address\" : \"<address>\" }, (object) An address\n"
+            "      { \"script\" : \"<scriptPubKey>\" }, (object) A scriptPubKey in hex\n"
+            "      { \"pubkey\" : \"<pubkey>\" },   (object) A public key in hex, matching its P2PK and P2PKH outputs,\n"
+            "                                      and its P2WPKH and P2SH-P2WPKH outputs if it is compressed\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult (for \"start\"):\n"
+            "{\n"
+            "  \"success\": true|false,         (boolean) Whether the scan completed (false if it was aborted)\n"
+            "  \"searched_items\": n,          (numeric) The number of unspent transaction outputs scanned\n"
+            "  \"height\": n,                  (numeric) The block height at which the scan was done\n"
+            "  \"bestblock\": \"hex\",           (string) The hash of the block at the tip of the chain\n"
+            "  \"unspents\": [\n"
+            "    {\n"
+            "      \"txid\" : \"transactionid\",   (string) The transaction id\n"
+            "      \"vout\": n,                  (numeric) The vout value\n"
+            "      \"scriptPubKey\" : \"script\",  (string) The script key\n"
+            "      \"amount\" : x.xxx,           (numeric) The total amount in " + CURRENCY_UNIT + " of the unspent output\n"
+            "      \"height\" : n,               (numeric) Height of the unspent transaction output\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"total_amount\" : x.xxx,        (numeric) The total amount of all found unspent outputs in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nResult (for \"status\"):\n"
+            "{\n"
+            "  \"progress\" : n                (numeric) The approximate progress of the scan in %\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("scantxoutset", "start \"[\\\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2\\\"]\"")
+            + HelpExampleCli("scantxoutset", "status")
+            + HelpExampleRpc("scantxoutset", "\"start\", [{\"pubkey\": \"0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798\"}]")
+        );
+
+    RPCTypeCheck(request.params, {UniValue::VSTR, UniValue::VARR});
+
+    UniValue result(UniValue::VOBJ);
+    if (request.params[0].get_str() == "status") {
+        CoinsViewScanReserver reserver;
+        if (reserver.reserve()) {
+            // no scan in progress
+            return NullUniValue;
+        }
+        result.pushKV("progress", (int)(g_scan_parts_done * 100 / SCAN_TXOUTSET_PARTS));
+        return result;
+    } else if (request.params[0].get_str() == "abort") {
+        CoinsViewScanReserver reserver;
+        if (reserver.reserve()) {
+            // reserve was possible which means no scan was running
+            return false;
+        }
+        // set the abort flag
+        g_should_abort_scan = true;
+        return true;
+    } else if (request.params[0].get_str() == "start") {
+        CoinsViewScanReserver reserver;
+        if (!reserver.reserve()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan already in progress, use action \"abort\" or \"status\"");
+        }
+        if (request.params[1].isNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "scanobjects argument is required for the start action");
+        }
+
+        ScriptSet needles;
+        for (const UniValue& scanobject : request.params[1].get_array().getValues()) {
+            AddScanObjectScripts(scanobject, needles);
+        }
+
+        // Scan the unspent transaction output set for the scripts
+        g_scan_parts_done = 0;
+        g_should_abort_scan = false;
+        FlushStateToDisk();
+        std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = pcoinsdbview->Cursors(SCAN_TXOUTSET_PARTS);
+        const uint256 hashBlock = cursors.front()->GetBestBlock();
+        int nHeight;
+        {
+            LOCK(cs_main);
+            BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+            if (it == mapBlockIndex.end()) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+            }
+            nHeight = it->second->nHeight;
+        }
+
+        std::vector<std::pair<COutPoint, Coin>> found;
+        uint64_t nSearchedItems = 0;
+        const bool fSuccess = FindScriptPubKeys(cursors, needles, found, nSearchedItems);
+        result.pushKV("success", fSuccess);
+        result.pushKV("searched_items", nSearchedItems);
+        result.pushKV("height", nHeight);
+        result.pushKV("bestblock", hashBlock.GetHex());
+
+        CAmount nTotalIn = 0;
+        UniValue unspents(UniValue::VARR);
+        for (const std::pair<COutPoint, Coin>& it : found) {
+            const COutPoint& outpoint = it.first;
+            const Coin& coin = it.second;
+            const CTxOut& txo = coin.out;
+            nTotalIn += txo.nValue;
+
+            UniValue unspent(UniValue::VOBJ);
+            unspent.pushKV("txid", outpoint.hash.GetHex());
+            unspent.pushKV("vout", (int32_t)outpoint.n);
+            unspent.pushKV("scriptPubKey", HexStr(txo.scriptPubKey.begin(), txo.scriptPubKey.end()));
+            unspent.pushKV("amount", ValueFromAmount(txo.nValue));
+            unspent.pushKV("height", (int32_t)coin.nHeight);
+
+            unspents.push_back(unspent);
+        }
+        result.pushKV("unspents", unspents);
+        result.pushKV("total_amount", ValueFromAmount(nTotalIn));
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid command");
+    }
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1633,9 +2246,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_or_height","hash_type"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path"} },
+    { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
@@ -17,6 +17,7 @@
 #include <rpc/server.h>
 #include <rpc/util.h>
 #include <timedata.h>
+#include <txdb.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #ifdef ENABLE_WALLET
@@ -448,6 +449,33 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCDatabaseInfo(size_t nUsage, const DBWriteStalls& stalls)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("used", uint64_t(nUsage));
+    obj.pushKV("slowdowns", stalls.slowdowns);
+    obj.pushKV("slowdown_time", stalls.slowdown_micros / 1e6);
+    obj.pushKV("memtable_waits", stalls.memtable_waits);
+    obj.pushKV("memtable_wait_time", stalls.memtable_micros / 1e6);
+    obj.pushKV("level0_waits", stalls.level0_waits);
+    obj.pushKV("level0_wait_time", stalls.level0_micros / 1e6);
+    return obj;
+}
+
+static UniValue RPCLevelDBInfo()
+{
+    // No cs_main: LevelDB reads these under its own mutex, and the databases
+    // are only replaced while RPC is in warmup or stopped.
+    UniValue obj(UniValue::VOBJ);
+    if (pcoinsdbview) {
+        obj.pushKV("chainstate", RPCDatabaseInfo(pcoinsdbview->DynamicMemoryUsage(), pcoinsdbview->GetWriteStalls()));
+    }
+    if (pblocktree) {
+        obj.pushKV("blockindex", RPCDatabaseInfo(pblocktree->DynamicMemoryUsage(), pblocktree->GetWriteStalls()));
+    }
+    return obj;
+}
+
 #ifdef HAVE_MALLOC_INFO
 static std::string RPCMallocInfo()
 {
@@ -489,6 +517,17 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"leveldb\": {              (json object) LevelDB databases, by name (chainstate, blockindex)\n"
+            "    \"name\": {\n"
+            "      \"used\": xxxxx,               (numeric) Bytes used by the block cache and write buffers\n"
+            "      \"slowdowns\": xxxxx,          (numeric) Writes delayed by 1ms because level 0 of the database was filling up\n"
+            "      \"slowdown_time\": x.xxx,      (numeric) Seconds spent in those delays\n"
+            "      \"memtable_waits\": xxxxx,     (numeric) Times writes waited for the previous write buffer to be written out\n"
+            "      \"memtable_wait_time\": x.xxx, (numeric) Seconds spent waiting for write buffers\n"
+            "      \"level0_waits\": xxxxx,       (numeric) Times writes waited because level 0 had too many files\n"
+            "      \"level0_wait_time\": x.xxx,   (numeric) Seconds spent waiting for level 0 compactions\n"
+            "    }, ...\n"
             "  }\n"
             "}\n"
             "\nResult (mode \"mallocinfo\"):\n"
@@ -502,6 +541,7 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("locked", RPCLockedMemoryInfo());
+        obj.pushKV("leveldb", RPCLevelDBInfo());
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
@@ -59,6 +59,11 @@ public:
         stream->read(pch, nSize);
     }
 
+    void ignore(size_t nSize)
+    {
+        stream->ignore(nSize);
+    }
+
     int GetVersion() const { return nVersion; }
     int GetType() const { return nType; }
 };
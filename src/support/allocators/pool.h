@@ -0,0 +1,196 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <assert.h>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * A memory resource for node-based containers, which allocate many blocks of
+ * the same small size.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are carved out of large chunks, with no
+ * per-block header, and rounded up to a multiple of ALIGN_BYTES only. Freed
+ * blocks go to a free list for their size, from which later allocations of
+ * that size are served first. Chunks are only returned to the system when the
+ * resource is destroyed. Larger blocks, like the bucket array of a hash table,
+ * are allocated with operator new.
+ *
+ * The memory held is thus at most one chunk more than the most that was in use
+ * at any one time. A resource is not thread-safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    struct ListNode {
+        ListNode* m_next;
+
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+
+    //! Blocks are sized and aligned to multiples of this.
+    static constexpr std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "a free block must be able to hold a ListNode");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned for std::max_align_t");
+    static_assert((MAX_BLOCK_SIZE_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "MAX_BLOCK_SIZE_BYTES must be a multiple of ELEM_ALIGN_BYTES");
+
+    const std::size_t m_chunk_size_bytes;
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    //! Free blocks, by their size in multiples of ELEM_ALIGN_BYTES
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+    //! The part of the newest chunk that no block was carved from yet
+    char* m_available_begin = nullptr;
+    char* m_available_end = nullptr;
+    //! Bytes of the pooled blocks in use
+    std::size_t m_used_bytes = 0;
+
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return bytes == 0 ? 1 : (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES;
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    static void AddToList(void* p, ListNode*& list)
+    {
+        list = new (p) ListNode(list);
+    }
+
+    void AllocateChunk()
+    {
+        // What is left of the current chunk is smaller than the block that
+        // did not fit in it, so it can always go on a free list.
+        if (m_available_begin != m_available_end) {
+            AddToList(m_available_begin, m_free_lists[(m_available_end - m_available_begin) / ELEM_ALIGN_BYTES]);
+        }
+        m_chunks.emplace_back(new char[m_chunk_size_bytes]);
+        m_available_begin = m_chunks.back().get();
+        m_available_end = m_available_begin + m_chunk_size_bytes;
+    }
+
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE_BYTES = 256 << 10;
+
+    explicit PoolResource(std::size_t chunk_size_bytes = DEFAULT_CHUNK_SIZE_BYTES)
+        : m_chunk_size_bytes(chunk_size_bytes / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            return ::operator new(bytes);
+        }
+        const std::size_t num_elem_align_bytes = NumElemAlignBytes(bytes);
+        const std::size_t block_size_bytes = num_elem_align_bytes * ELEM_ALIGN_BYTES;
+        void* p;
+        ListNode*& list = m_free_lists[num_elem_align_bytes];
+        if (list != nullptr) {
+            p = list;
+            list = list->m_next;
+        } else {
+            if (static_cast<std::size_t>(m_available_end - m_available_begin) < block_size_bytes) {
+                AllocateChunk();
+            }
+            p = m_available_begin;
+            m_available_begin += block_size_bytes;
+        }
+        m_used_bytes += block_size_bytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const std::size_t num_elem_align_bytes = NumElemAlignBytes(bytes);
+        m_used_bytes -= num_elem_align_bytes * ELEM_ALIGN_BYTES;
+        AddToList(p, m_free_lists[num_elem_align_bytes]);
+    }
+
+    //! Bytes of the pooled blocks that are allocated, including their rounding
+    std::size_t UsedBytes() const { return m_used_bytes; }
+
+    std::size_t NumAllocatedChunks() const { return m_chunks.size(); }
+
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+};
+
+/**
+ * Allocator that takes its memory from a PoolResource, which must outlive
+ * every container using it. Containers whose elements are at most
+ * MAX_BLOCK_SIZE_BYTES, node included, have all their elements pooled.
+ */
+template <typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+private:
+    PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* m_resource;
+
+    template <typename U, std::size_t M, std::size_t A>
+    friend class PoolAllocator;
+
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.m_resource)
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+};
+
+template <typename T1, typename T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T1, typename T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -0,0 +1,158 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilereader.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <test/test_bitcoin.h>
+#include <validation.h>
+
+#include <ios>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+struct BlockFileReaderTestingSetup : public BasicTestingSetup {
+    const fs::path dir = fs::temp_directory_path() / fs::unique_path();
+
+    BlockFileReaderTestingSetup() { fs::create_directories(dir); }
+    ~BlockFileReaderTestingSetup() { fs::remove_all(dir); }
+
+    fs::path WriteTestFile(const std::string& name, const std::vector<unsigned char>& data)
+    {
+        fs::path path = dir / name;
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        file.write((const char*)data.data(), data.size());
+        return path;
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockfilereader_tests, BlockFileReaderTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockfilereader_read)
+{
+    std::vector<unsigned char> data(10000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = InsecureRandBits(8);
+    }
+    fs::path path = WriteTestFile("read.dat", data);
+
+    BlockFileReader reader(2);
+    std::vector<char> buf(data.size());
+    BOOST_CHECK_EQUAL(reader.Read(path, 0, buf.data(), data.size()), data.size());
+    BOOST_CHECK(std::equal(buf.begin(), buf.end(), (const char*)data.data()));
+    BOOST_CHECK_EQUAL(reader.Read(path, 1234, buf.data(), 10), 10U);
+    BOOST_CHECK(std::equal(buf.begin(), buf.begin() + 10, (const char*)data.data() + 1234));
+
+    // Reads stop at the end of the file.
+    BOOST_CHECK_EQUAL(reader.Read(path, data.size() - 5, buf.data(), 10), 5U);
+    BOOST_CHECK_EQUAL(reader.Read(path, data.size() + 5, buf.data(), 10), 0U);
+
+    // Missing files cannot be read.
+    BOOST_CHECK_THROW(reader.Read(dir / "missing.dat", 0, buf.data(), 1), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_close)
+{
+    fs::path path1 = WriteTestFile("file1.dat", {1});
+    fs::path path2 = WriteTestFile("file2.dat", {2});
+    fs::path path3 = WriteTestFile("file3.dat", {3});
+
+    BlockFileReader reader(2);
+    char c;
+    BOOST_CHECK_EQUAL(reader.Read(path1, 0, &c, 1), 1U);
+
+    // A file that was closed is opened anew, and sees a replaced file.
+    reader.Close(path1);
+    fs::remove(path1);
+    WriteTestFile("file1.dat", {4});
+    BOOST_CHECK_EQUAL(reader.Read(path1, 0, &c, 1), 1U);
+    BOOST_CHECK_EQUAL(c, 4);
+
+    // Files that do not fit are closed, least recently used first.
+    BOOST_CHECK_EQUAL(reader.Read(path2, 0, &c, 1), 1U);
+    BOOST_CHECK_EQUAL(reader.Read(path3, 0, &c, 1), 1U);
+    BOOST_CHECK_EQUAL(c, 3);
+    fs::remove(path1);
+    WriteTestFile("file1.dat", {5});
+    BOOST_CHECK_EQUAL(reader.Read(path1, 0, &c, 1), 1U);
+    BOOST_CHECK_EQUAL(c, 5);
+
+    reader.Clear();
+    fs::remove(path1);
+    BOOST_CHECK_THROW(reader.Read(path1, 0, &c, 1), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_stream)
+{
+    // Objects of all sizes, so that reads span refills of the stream's buffer.
+    std::vector<std::vector<unsigned char>> objects;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    for (size_t size = 0; size < 200000; size = size * 3 + 1) {
+        objects.emplace_back(size, (unsigned char)size);
+        ss << objects.back();
+    }
+    ss << uint32_t{0x01020304};
+    fs::path path = WriteTestFile("stream.dat", std::vector<unsigned char>(ss.begin(), ss.end()));
+
+    BlockFileStream stream(g_blockfilereader, path, 0, SER_DISK, CLIENT_VERSION);
+    for (const std::vector<unsigned char>& object : objects) {
+        std::vector<unsigned char> read;
+        stream >> read;
+        BOOST_CHECK(read == object);
+    }
+    uint32_t n;
+    stream >> n;
+    BOOST_CHECK_EQUAL(n, 0x01020304U);
+    BOOST_CHECK_THROW(stream >> n, std::ios_base::failure);
+
+    // Skip to the last object from a position other than the start of the file.
+    const size_t nLastPos = ss.size() - 4 - GetSerializeSize(objects.back(), SER_DISK, CLIENT_VERSION);
+    BlockFileStream stream2(g_blockfilereader, path, 1, SER_DISK, CLIENT_VERSION);
+    stream2.ignore(nLastPos - 1);
+    std::vector<unsigned char> read;
+    stream2 >> read;
+    BOOST_CHECK(read == objects.back());
+    g_blockfilereader.Close(path);
+}
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive[50];
+    }
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+
+    // The block as stored is its network serialization.
+    std::shared_ptr<const std::vector<unsigned char>> raw;
+    BOOST_CHECK(ReadRawBlockFromDisk(raw, pindex, Params().MessageStart()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == *raw);
+    BOOST_CHECK(!RawBlockHasWitness(*raw));
+
+    // Blocks that were read recently are served from memory.
+    std::shared_ptr<const std::vector<unsigned char>> raw2;
+    BOOST_CHECK(ReadRawBlockFromDisk(raw2, pindex, Params().MessageStart()));
+    BOOST_CHECK(raw2 == raw);
+
+    // Blocks with witness data are recognized.
+    CMutableTransaction coinbase(*block.vtx[0]);
+    coinbase.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 0));
+    block.vtx[0] = MakeTransactionRef(coinbase);
+    CDataStream ssWitness(SER_NETWORK, PROTOCOL_VERSION);
+    ssWitness << block;
+    BOOST_CHECK(RawBlockHasWitness(std::vector<unsigned char>(ssWitness.begin(), ssWitness.end())));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
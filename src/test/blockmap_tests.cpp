@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockmap.h>
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockmap_insert_find)
+{
+    BlockMap map;
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(InsecureRand256()) == map.end());
+
+    // Enough entries to span several arena chunks and table resizes.
+    std::vector<uint256> hashes;
+    std::vector<CBlockIndex*> entries;
+    for (int i = 0; i < 10000; i++) {
+        hashes.push_back(InsecureRand256());
+        auto inserted = map.emplace(hashes.back());
+        BOOST_CHECK(inserted.second);
+        BOOST_CHECK(inserted.first->first == hashes.back());
+        CBlockIndex* pindex = inserted.first->second;
+        BOOST_CHECK(pindex->GetBlockHash() == hashes.back());
+        pindex->nHeight = i;
+        entries.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(map.size(), hashes.size());
+
+    // Entries keep their address, and inserting a known block returns its entry.
+    for (size_t i = 0; i < hashes.size(); i++) {
+        BOOST_CHECK(map[hashes[i]] == entries[i]);
+        BOOST_CHECK_EQUAL(map.count(hashes[i]), 1U);
+        auto inserted = map.emplace(hashes[i]);
+        BOOST_CHECK(!inserted.second);
+        BOOST_CHECK(inserted.first->second == entries[i]);
+    }
+    BOOST_CHECK_EQUAL(map.size(), hashes.size());
+
+    // Looking up an unknown block does not insert it.
+    const uint256 unknown = InsecureRand256();
+    BOOST_CHECK(map[unknown] == nullptr);
+    BOOST_CHECK_EQUAL(map.count(unknown), 0U);
+    BOOST_CHECK_EQUAL(map.size(), hashes.size());
+
+    // Iteration visits the entries in insertion order.
+    int nHeight = 0;
+    for (const BlockMap::value_type& item : map) {
+        BOOST_CHECK(item.first == hashes[nHeight]);
+        BOOST_CHECK_EQUAL(item.second->nHeight, nHeight);
+        nHeight++;
+    }
+    BOOST_CHECK_EQUAL(nHeight, 10000);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map[hashes[0]] == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_colliding_hashes)
+{
+    // Hashes that agree in their truncated hash are told apart by the full hash.
+    BlockMap map;
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 100; i++) {
+        uint256 hash;
+        *(hash.begin() + 31) = i + 1;
+        hashes.push_back(hash);
+        CBlockHeader header;
+        header.nTime = i;
+        BOOST_CHECK(map.emplace(hash, header).second);
+    }
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(map[hashes[i]]->nTime, (uint32_t)i);
+    }
+    BOOST_CHECK(map[uint256()] == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
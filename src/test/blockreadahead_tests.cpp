@@ -0,0 +1,71 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <test/test_bitcoin.h>
+#include <validation.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockreadahead_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(blockreadahead_schedule)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    LOCK(cs_main);
+    // The blocks to connect from the highest to the lowest, as built by
+    // ActivateBestChainStep.
+    std::vector<CBlockIndex*> vpindex;
+    for (int nHeight = chainActive.Height(); nHeight > 0; nHeight--) {
+        vpindex.push_back(chainActive[nHeight]);
+    }
+    BOOST_REQUIRE(nBlockReadAhead > 2 && nBlockReadAhead + 20 < chainActive.Height());
+
+    // The lowest nBlockReadAhead blocks are read and checked, except the one
+    // skipped, and each can be taken once.
+    CBlockReadAhead readahead;
+    readahead.Schedule(vpindex, chainActive[2], params);
+    BOOST_CHECK(!readahead.Take(chainActive[2]->GetBlockHash()));
+    for (int nHeight = 1; nHeight <= nBlockReadAhead + 1; nHeight++) {
+        if (nHeight == 2) continue;
+        std::shared_ptr<const CBlock> pblock = readahead.Take(chainActive[nHeight]->GetBlockHash());
+        BOOST_REQUIRE(pblock);
+        BOOST_CHECK(pblock->GetHash() == chainActive[nHeight]->GetBlockHash());
+        BOOST_CHECK(pblock->fChecked);
+    }
+    BOOST_CHECK(!readahead.Take(chainActive[1]->GetBlockHash()));
+    BOOST_CHECK(!readahead.Take(chainActive[nBlockReadAhead + 2]->GetBlockHash()));
+
+    // Scheduling again keeps the reads still in the window and drops the others.
+    readahead.Schedule(vpindex, nullptr, params);
+    readahead.Schedule(std::vector<CBlockIndex*>(vpindex.begin(), vpindex.end() - 4), nullptr, params);
+    BOOST_CHECK(!readahead.Take(chainActive[4]->GetBlockHash()));
+    BOOST_CHECK(readahead.Take(chainActive[5]->GetBlockHash()));
+    BOOST_CHECK(readahead.Take(chainActive[nBlockReadAhead + 4]->GetBlockHash()));
+    BOOST_CHECK(!readahead.Take(chainActive[nBlockReadAhead + 5]->GetBlockHash()));
+
+    // The window ends at a block without data.
+    chainActive[20]->nStatus &= ~BLOCK_HAVE_DATA;
+    readahead.Schedule(std::vector<CBlockIndex*>(vpindex.begin(), vpindex.end() - 18), nullptr, params);
+    chainActive[20]->nStatus |= BLOCK_HAVE_DATA;
+    BOOST_CHECK(readahead.Take(chainActive[19]->GetBlockHash()));
+    BOOST_CHECK(!readahead.Take(chainActive[21]->GetBlockHash()));
+
+    // A block that cannot be read is left for the caller to read.
+    const unsigned int nDataPos = chainActive[1]->nDataPos;
+    chainActive[1]->nDataPos = chainActive[2]->nDataPos;
+    readahead.Schedule(vpindex, nullptr, params);
+    chainActive[1]->nDataPos = nDataPos;
+    BOOST_CHECK(!readahead.Take(chainActive[1]->GetBlockHash()));
+    BOOST_CHECK(readahead.Take(chainActive[3]->GetBlockHash()));
+
+    // Clearing drops all reads.
+    readahead.Clear();
+    BOOST_CHECK(!readahead.Take(chainActive[4]->GetBlockHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
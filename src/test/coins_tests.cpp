@@ -8,11 +8,15 @@
 #include <undo.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
 #include <consensus/validation.h>
 
 #include <vector>
 #include <map>
+#include <memory>
+#include <set>
+#include <thread>
 
 #include <boost/test/unit_test.hpp>
 
@@ -74,23 +78,27 @@ public:
 class CCoinsViewCacheTest : public CCoinsViewCache
 {
 public:
-    explicit CCoinsViewCacheTest(CCoinsView* _base) : CCoinsViewCache(_base) {}
+    explicit CCoinsViewCacheTest(CCoinsView* _base, size_t nShards = 1) : CCoinsViewCache(_base, nShards) {}
 
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins);
+        size_t ret = 0;
         size_t count = 0;
-        for (const auto& entry : cacheCoins) {
-            ret += entry.second.coin.DynamicMemoryUsage();
-            ++count;
+        for (const auto& shard : m_shards) {
+            ret += memusage::DynamicUsage(*shard->map);
+            for (const auto& entry : *shard->map) {
+                BOOST_CHECK(&GetShard(entry.first) == shard.get());
+                ret += entry.second.coin.DynamicMemoryUsage();
+                ++count;
+            }
         }
         BOOST_CHECK_EQUAL(GetCacheSize(), count);
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
-    CCoinsMap& map() const { return cacheCoins; }
-    size_t& usage() const { return cachedCoinsUsage; }
+    CCoinsMap& map() const { assert(m_shards.size() == 1); return *m_shards[0]->map; }
+    size_t& usage() const { assert(m_shards.size() == 1); return m_shards[0]->cachedCoinsUsage; }
 };
 
 } // namespace
@@ -127,7 +135,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
     std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
+    stack.push_back(new CCoinsViewCacheTest(&base, 1 + InsecureRandBits(2))); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -229,7 +237,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCacheTest(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip, 1 + InsecureRandBits(2)));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -586,7 +594,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map = MakeCoinsMap(resource);
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
@@ -770,6 +779,42 @@ BOOST_AUTO_TEST_CASE(ccoins_add)
     CheckAddCoin(VALUE2, VALUE3, VALUE3, DIRTY|FRESH, DIRTY|FRESH, true );
 }
 
+void CheckWarmCoin(CAmount cache_value, CAmount warm_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+
+    CTxOut output;
+    output.nValue = warm_value;
+    test.cache.WarmCoin(OUTPOINT, Coin(std::move(output), 1, false));
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_warm)
+{
+    /* Check WarmCoin behavior, inserting a coin read from the base view into
+     * a cache view, and checking the resulting entry in the cache. A warmed
+     * entry must never be marked modified, and existing entries win.
+     *
+     *            Cache   Warm    Result  Cache        Result
+     *            Value   Value   Value   Flags        Flags
+     */
+    CheckWarmCoin(ABSENT, VALUE3, VALUE3, NO_ENTRY   , 0          );
+    CheckWarmCoin(PRUNED, VALUE3, PRUNED, 0          , 0          );
+    CheckWarmCoin(PRUNED, VALUE3, PRUNED, FRESH      , FRESH      );
+    CheckWarmCoin(PRUNED, VALUE3, PRUNED, DIRTY      , DIRTY      );
+    CheckWarmCoin(PRUNED, VALUE3, PRUNED, DIRTY|FRESH, DIRTY|FRESH);
+    CheckWarmCoin(VALUE2, VALUE3, VALUE2, 0          , 0          );
+    CheckWarmCoin(VALUE2, VALUE3, VALUE2, FRESH      , FRESH      );
+    CheckWarmCoin(VALUE2, VALUE3, VALUE2, DIRTY      , DIRTY      );
+    CheckWarmCoin(VALUE2, VALUE3, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
+}
+
 void CheckWriteCoins(CAmount parent_value, CAmount child_value, CAmount expected_value, char parent_flags, char child_flags, char expected_flags)
 {
     SingleEntryCacheTest test(ABSENT, parent_value, parent_flags);
@@ -855,4 +900,366 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_flush_retain)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 100; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(coin), false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+
+    // Written entries stay cached, no longer modified.
+    BOOST_CHECK(cache.Flush(false));
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    for (const auto& entry : cache.map()) {
+        BOOST_CHECK_EQUAL(entry.second.flags, 0);
+    }
+    Coin read;
+    BOOST_CHECK(base.GetCoin(outpoints[0], read) && read == coin);
+    BOOST_CHECK(base.GetBestBlock() == cache.GetBestBlock());
+
+    // Spent entries are written and dropped from the cache.
+    for (size_t i = 0; i < outpoints.size() / 2; i++) {
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    }
+    BOOST_CHECK(cache.Flush(false));
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size() / 2);
+    BOOST_CHECK(!base.GetCoin(outpoints[0], read) || read.IsSpent());
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[0]));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints.back()));
+
+    // Trimming never evicts modified entries, and evicts unmodified ones
+    // even if they were accessed recently.
+    const COutPoint added(InsecureRand256(), 0);
+    cache.AddCoin(added, Coin(coin), false);
+    BOOST_CHECK(cache.AccessCoin(outpoints.back()) == coin);
+    cache.Trim(cache.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size() / 2 + 1);
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(added));
+    BOOST_CHECK(cache.AccessCoin(outpoints.back()) == coin);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_trim_usage)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    for (int i = 0; i < 20000; i++) {
+        cache.AddCoin(COutPoint(InsecureRand256(), i), Coin(coin), false);
+    }
+    BOOST_CHECK(cache.Flush(false));
+    const size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 4 * CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES);
+
+    // Evicting entries lowers the usage only once their pool memory is
+    // released, which trimming does.
+    cache.Trim(nUsage / 2);
+    cache.SelfTest();
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nUsage / 2);
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= memusage::MallocUsage(CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sharded_reads)
+{
+    CCoinsViewTest base;
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache writer(&base);
+        for (int i = 0; i < 1000; i++) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            // Every third outpoint has no coin.
+            if (i % 3 != 0) writer.AddCoin(outpoints.back(), Coin(coin), false);
+        }
+        BOOST_CHECK(writer.Flush());
+    }
+
+    // Threads looking up the same coins at once each see all of them, and
+    // the cache ends up with one entry per coin.
+    CCoinsViewCacheTest cache(&base, 8);
+    std::vector<std::thread> threads;
+    std::vector<int> vErrors(4);
+    for (size_t t = 0; t < vErrors.size(); t++) {
+        threads.emplace_back([&, t] {
+            for (size_t i = 0; i < outpoints.size(); i++) {
+                const COutPoint& outpoint = outpoints[(i * (t + 1)) % outpoints.size()];
+                const bool fExpected = outpoint.n % 3 != 0;
+                Coin read;
+                if (cache.HaveCoin(outpoint) != fExpected) vErrors[t]++;
+                if (cache.GetCoin(outpoint, read) != fExpected || (fExpected && !(read == coin))) vErrors[t]++;
+                if (cache.AccessCoin(outpoint).IsSpent() == fExpected) vErrors[t]++;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (int nErrors : vErrors) {
+        BOOST_CHECK_EQUAL(nErrors, 0);
+    }
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 666U);
+
+    // Modified entries of all shards are written in one batch.
+    for (size_t i = 1; i < outpoints.size(); i += 3) {
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    }
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 333U);
+    BOOST_CHECK(cache.Flush(false));
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        Coin read;
+        BOOST_CHECK_EQUAL(base.GetCoin(outpoints[i], read) && !read.IsSpent(), i % 3 == 2);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_async_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewAsyncFlush async(&db);
+    CCoinsViewCache cache(&async);
+
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    const COutPoint spent(InsecureRand256(), 0);
+    const COutPoint kept(InsecureRand256(), 1);
+    const COutPoint added(InsecureRand256(), 2);
+
+    // A synchronous flush leaves nothing in flight.
+    cache.AddCoin(spent, Coin(coin), false);
+    cache.AddCoin(kept, Coin(coin), false);
+    const uint256 block1 = InsecureRand256();
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(async.Sync());
+    BOOST_CHECK(!async.IsWriting());
+    BOOST_CHECK(db.GetBestBlock() == block1);
+    BOOST_CHECK(db.HaveCoin(spent));
+    BOOST_CHECK(db.HaveCoin(kept));
+
+    // Spend a coin, add another, and write both changes in the background.
+    BOOST_CHECK(cache.SpendCoin(spent));
+    cache.AddCoin(added, Coin(coin), false);
+    const uint256 block2 = InsecureRand256();
+    cache.SetBestBlock(block2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(async.IsWriting());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(async.DynamicMemoryUsage() > 0);
+
+    // Reads reflect the handed-off changes whether or not the write is done.
+    BOOST_CHECK(async.GetBestBlock() == block2);
+    BOOST_CHECK(!async.HaveCoin(spent));
+    BOOST_CHECK(async.HaveCoin(kept));
+    BOOST_CHECK(async.HaveCoin(added));
+    BOOST_CHECK(!cache.HaveCoin(spent));
+    BOOST_CHECK(cache.AccessCoin(added).out == coin.out);
+
+    BOOST_CHECK(async.Sync());
+    BOOST_CHECK(!async.IsWriting());
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    BOOST_CHECK(!db.HaveCoin(spent));
+    BOOST_CHECK(db.HaveCoin(kept));
+    BOOST_CHECK(db.HaveCoin(added));
+    BOOST_CHECK_EQUAL(async.DynamicMemoryUsage(), 0U);
+
+    // A sharded cache hands the entries of all its shards over in one write,
+    // whether it keeps them or not.
+    CCoinsViewCache sharded(&async, 4);
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 100; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        sharded.AddCoin(outpoints.back(), Coin(coin), false);
+    }
+    const uint256 block3 = InsecureRand256();
+    sharded.SetBestBlock(block3);
+    BOOST_CHECK(sharded.Flush(false));
+    BOOST_CHECK_EQUAL(sharded.GetCacheSize(), outpoints.size());
+    BOOST_CHECK(async.Sync());
+    BOOST_CHECK(db.GetBestBlock() == block3);
+    for (size_t i = 0; i < outpoints.size(); i += 2) {
+        BOOST_CHECK(sharded.SpendCoin(outpoints[i]));
+    }
+    const uint256 block4 = InsecureRand256();
+    sharded.SetBestBlock(block4);
+    BOOST_CHECK(sharded.Flush(true));
+    BOOST_CHECK_EQUAL(sharded.GetCacheSize(), 0U);
+    BOOST_CHECK(async.Sync());
+    BOOST_CHECK(db.GetBestBlock() == block4);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        BOOST_CHECK_EQUAL(db.HaveCoin(outpoints[i]), i % 2 != 0);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_flush_retain_usage, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewAsyncFlush async(&db);
+    CCoinsViewCacheTest cache(&async, 16);
+
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 50000; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(coin), false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+
+    // A cache of modified entries within 10% of its limit keeps what fits
+    // next to the entries being written, and hands the rest over.
+    const size_t nLimit = cache.DynamicMemoryUsage() / 10 * 11;
+    BOOST_CHECK(cache.Flush(false, nLimit));
+    cache.SelfTest();
+    BOOST_CHECK(async.IsWriting());
+    BOOST_CHECK(cache.DynamicMemoryUsage() + async.DynamicMemoryUsage() <= nLimit);
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+    BOOST_CHECK(cache.GetCacheSize() < outpoints.size());
+    BOOST_CHECK(async.Sync());
+    for (size_t i = 0; i < outpoints.size(); i += 1000) {
+        BOOST_CHECK(db.HaveCoin(outpoints[i]));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_db_cursors, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache cache(&db);
+
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    std::set<COutPoint> outpoints;
+    for (int i = 0; i < 500; i++) {
+        const COutPoint outpoint(InsecureRand256(), InsecureRandRange(3));
+        cache.AddCoin(outpoint, Coin(coin), true);
+        outpoints.insert(outpoint);
+    }
+    uint256 block = InsecureRand256();
+    cache.SetBestBlock(block);
+    BOOST_CHECK(cache.Flush());
+
+    for (unsigned int nParts : {1, 2, 7, 64, 300}) {
+        std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = db.Cursors(nParts);
+        BOOST_CHECK_EQUAL(cursors.size(), nParts);
+
+        // Adding coins after the cursors were created does not affect them.
+        cache.AddCoin(COutPoint(InsecureRand256(), 0), Coin(coin), false);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+
+        // The ranges are disjoint, ordered and together cover every coin.
+        std::set<COutPoint> found;
+        COutPoint prev;
+        for (const std::unique_ptr<CCoinsViewCursor>& pcursor : cursors) {
+            BOOST_CHECK(pcursor->GetBestBlock() == block);
+            for (; pcursor->Valid(); pcursor->Next()) {
+                COutPoint key;
+                Coin value;
+                BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(value));
+                BOOST_CHECK(found.empty() || prev.hash < key.hash || (prev.hash == key.hash && prev.n < key.n));
+                BOOST_CHECK(found.insert(key).second);
+                prev = key;
+            }
+        }
+        BOOST_CHECK(found == outpoints);
+
+        // Later cursors see the coins added since.
+        std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        outpoints.clear();
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint key;
+            BOOST_CHECK(pcursor->GetKey(key));
+            outpoints.insert(key);
+        }
+        BOOST_CHECK_EQUAL(outpoints.size(), found.size() + 1);
+        block = db.GetBestBlock();
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_prefetch_connect, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> noTxns;
+    for (int i = 0; i < 25; i++) {
+        CreateAndProcessBlock(noTxns, scriptPubKey);
+    }
+
+    // Spends of mature coinbases, and a spend of the first of them within
+    // the same block.
+    std::vector<CMutableTransaction> spends(22);
+    for (size_t i = 0; i < spends.size(); i++) {
+        CMutableTransaction& tx = spends[i];
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        if (i + 1 < spends.size()) {
+            tx.vin[0].prevout = COutPoint(coinbaseTxns[i].GetHash(), 0);
+        } else {
+            tx.vin[0].prevout = COutPoint(spends[0].GetHash(), 0);
+        }
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 11 * CENT;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig;
+    }
+
+    // Most inputs are left on disk for the prefetch threads to read, while
+    // ConnectBlock itself reads the one still in the cache and the one
+    // created in the block.
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(pcoinsTip->Flush());
+        BOOST_CHECK(pcoinsflushing->Sync());
+        for (size_t i = 0; i + 1 < spends.size(); i++) {
+            BOOST_CHECK(!pcoinsTip->HaveCoinInCache(spends[i].vin[0].prevout));
+        }
+        BOOST_CHECK(!pcoinsTip->AccessCoin(spends[20].vin[0].prevout).IsSpent());
+    }
+
+    CBlock block = CreateAndProcessBlock(spends, scriptPubKey);
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    for (size_t i = 0; i < spends.size(); i++) {
+        BOOST_CHECK(!pcoinsTip->HaveCoin(spends[i].vin[0].prevout));
+        BOOST_CHECK_EQUAL(pcoinsTip->HaveCoin(COutPoint(spends[i].GetHash(), 0)), i != 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
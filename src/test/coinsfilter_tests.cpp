@@ -0,0 +1,116 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsfilter.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(coinsfilter_lookups)
+{
+    CoinsFilter filter(64 << 10);
+    BOOST_CHECK_EQUAL(filter.DynamicMemoryUsage(), 64U << 10);
+    BOOST_CHECK_EQUAL(filter.GetCapacity(), (64U << 13) / CoinsFilter::BITS_PER_ELEMENT);
+
+    std::vector<COutPoint> outpoints;
+    for (uint64_t i = 0; i < filter.GetCapacity(); i++) {
+        outpoints.emplace_back(InsecureRand256(), InsecureRandRange(10));
+        filter.Insert(outpoints.back());
+    }
+    BOOST_CHECK_EQUAL(filter.GetInserted(), outpoints.size());
+
+    // Every inserted outpoint is found, including other outputs of their
+    // transactions only rarely.
+    size_t nFalsePositives = 0;
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(filter.MayContain(outpoint));
+        nFalsePositives += filter.MayContain(COutPoint(outpoint.hash, outpoint.n + 10));
+    }
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        nFalsePositives += filter.MayContain(COutPoint(InsecureRand256(), 0));
+    }
+    BOOST_CHECK(nFalsePositives < outpoints.size() * 2 / 50);
+}
+
+BOOST_AUTO_TEST_CASE(coinsfilter_threads)
+{
+    CoinsFilter filter(16 << 10);
+    std::vector<std::vector<COutPoint>> outpoints(4);
+    for (std::vector<COutPoint>& part : outpoints) {
+        for (int i = 0; i < 2000; i++) {
+            part.emplace_back(InsecureRand256(), i);
+        }
+    }
+
+    // Concurrent inserts to the same blocks are not lost.
+    std::vector<std::thread> threads;
+    for (const std::vector<COutPoint>& part : outpoints) {
+        threads.emplace_back([&filter, &part] {
+            for (const COutPoint& outpoint : part) {
+                filter.Insert(outpoint);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(filter.GetInserted(), 8000U);
+    for (const std::vector<COutPoint>& part : outpoints) {
+        for (const COutPoint& outpoint : part) {
+            BOOST_CHECK(filter.MayContain(outpoint));
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coinsfilter_coins_db, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache cache(&db);
+
+    Coin coin;
+    coin.out.nValue = InsecureRand32();
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    std::vector<COutPoint> before;
+    for (int i = 0; i < 100; i++) {
+        before.emplace_back(InsecureRand256(), 0);
+        cache.AddCoin(before.back(), Coin(coin), false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+
+    BOOST_CHECK(db.LoadFilter(4 << 10));
+
+    // Coins written before and after the filter was built are found, and
+    // missing ones are not.
+    std::vector<COutPoint> after;
+    for (int i = 0; i < 100; i++) {
+        after.emplace_back(InsecureRand256(), 1);
+        cache.AddCoin(after.back(), Coin(coin), false);
+    }
+    BOOST_CHECK(cache.SpendCoin(before[0]));
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+    Coin read;
+    BOOST_CHECK(!db.GetCoin(before[0], read));
+    BOOST_CHECK(!db.HaveCoin(before[0]));
+    before.erase(before.begin());
+    for (const std::vector<COutPoint>* outpoints : {&before, &after}) {
+        for (const COutPoint& outpoint : *outpoints) {
+            BOOST_CHECK(db.GetCoin(outpoint, read));
+            BOOST_CHECK(db.HaveCoin(outpoint));
+        }
+    }
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK(!db.GetCoin(COutPoint(InsecureRand256(), 0), read));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
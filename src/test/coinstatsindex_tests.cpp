@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+#include <index/coinstatsindex.h>
+#include <init.h>
+#include <script/sign.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+/** Compute the statistics of the current chainstate by scanning it. */
+static CoinStatsRecord ScanStats()
+{
+    FlushStateToDisk();
+    CoinStatsRecord stats;
+    MuHash3072 muhash;
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+        ss << key << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase) << coin.out;
+        muhash.Insert(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += coin.out.nValue;
+        stats.nBogoSize += 50 + coin.out.scriptPubKey.size();
+    }
+    muhash.Finalize(stats.hashMuHash.begin());
+    return stats;
+}
+
+static const CBlockIndex* GetBlockAtHeight(int height)
+{
+    LOCK(cs_main);
+    return height < 0 ? chainActive.Tip() : chainActive[height];
+}
+
+static void CheckTipStats(CoinStatsIndex& coinstatsindex)
+{
+    BOOST_CHECK(coinstatsindex.BlockUntilSyncedToCurrentChain());
+    CoinStatsRecord stats;
+    BOOST_REQUIRE(coinstatsindex.LookUpStats(GetBlockAtHeight(-1), stats));
+    CoinStatsRecord expected = ScanStats();
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, expected.nTotalAmount);
+    BOOST_CHECK_EQUAL(stats.nBogoSize, expected.nBogoSize);
+    BOOST_CHECK(stats.hashMuHash == expected.hashMuHash);
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestChain100Setup)
+{
+    CoinStatsIndex coinstatsindex(MakeUnique<CoinStatsIndexDB>(1 << 20, true));
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!coinstatsindex.BlockUntilSyncedToCurrentChain());
+
+    coinstatsindex.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!coinstatsindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+    CheckTipStats(coinstatsindex);
+
+    // Spend a coinbase output in a new block, so the index has to remove
+    // spent coins as well as add new ones.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    spend.vout[1].nValue = 0;
+    spend.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    const CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    BOOST_CHECK(GetBlockAtHeight(-1)->GetBlockHash() == block.GetHash());
+    CheckTipStats(coinstatsindex);
+
+    // Statistics of earlier blocks stay available.
+    CoinStatsRecord stats;
+    BOOST_CHECK(coinstatsindex.LookUpStats(GetBlockAtHeight(100), stats));
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 100U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 100 * 50 * COIN);
+
+    coinstatsindex.Stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_restart_mid_sync, TestChain100Setup)
+{
+    constexpr int64_t timeout_ms = 10 * 1000;
+    {
+        CoinStatsIndex coinstatsindex(MakeUnique<CoinStatsIndexDB>(1 << 20, false, true));
+        coinstatsindex.Start();
+        int64_t time_start = GetTimeMillis();
+        while (!coinstatsindex.BlockUntilSyncedToCurrentChain()) {
+            BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+            MilliSleep(100);
+        }
+        coinstatsindex.Stop();
+    }
+
+    // Connect two blocks while the index is stopped, and make the undo data
+    // of the first unavailable, so that the next sync stops right after it
+    // starts, as if the node crashed there.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, scriptPubKey);
+    CreateAndProcessBlock({}, scriptPubKey);
+    CBlockIndex* pindex_missing;
+    {
+        LOCK(cs_main);
+        pindex_missing = chainActive[101];
+        pindex_missing->nStatus &= ~BLOCK_HAVE_UNDO;
+    }
+    {
+        CoinStatsIndex coinstatsindex(MakeUnique<CoinStatsIndexDB>(1 << 20, false, false));
+        coinstatsindex.Start();
+        int64_t time_start = GetTimeMillis();
+        while (!ShutdownRequested()) {
+            BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+            MilliSleep(10);
+        }
+        coinstatsindex.Stop();
+        CoinStatsRecord stats;
+        BOOST_CHECK(!coinstatsindex.LookUpStats(pindex_missing, stats));
+    }
+    AbortShutdown();
+    {
+        LOCK(cs_main);
+        pindex_missing->nStatus |= BLOCK_HAVE_UNDO;
+    }
+
+    // The index resumes from the last block it wrote, not from the one it
+    // failed on.
+    CoinStatsIndex coinstatsindex(MakeUnique<CoinStatsIndexDB>(1 << 20, false, false));
+    coinstatsindex.Start();
+    int64_t time_start = GetTimeMillis();
+    while (!coinstatsindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(!ShutdownRequested());
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+    CheckTipStats(coinstatsindex);
+    coinstatsindex.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,11 +2,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <clientversion.h>
 #include <compressor.h>
+#include <streams.h>
 #include <util.h>
 #include <test/test_bitcoin.h>
 
 #include <stdint.h>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -37,6 +40,18 @@ bool static TestPair(uint64_t dec, uint64_t enc) {
            CTxOutCompressor::DecompressAmount(enc) == dec;
 }
 
+/** Serialize a script compressed with the given stream version, and check that it reads back. */
+size_t static TestScript(CScript script, int nVersion) {
+    CDataStream ss(SER_DISK, nVersion);
+    ss << CScriptCompressor(script);
+    const size_t nSize = ss.size();
+    CScript read;
+    ss >> REF(CScriptCompressor(read));
+    BOOST_CHECK(read == script);
+    BOOST_CHECK(ss.empty());
+    return nSize;
+}
+
 BOOST_AUTO_TEST_CASE(compress_amounts)
 {
     BOOST_CHECK(TestPair(            0,       0x0));
@@ -62,4 +77,39 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+BOOST_AUTO_TEST_CASE(compress_scripts)
+{
+    const int nWitness = CLIENT_VERSION | SERIALIZE_COMPRESS_WITNESS_PROGRAMS;
+    const std::vector<unsigned char> vch20(20, 0x42), vch32(32, 0x42);
+
+    // Witness programs are only special with the flag.
+    const CScript p2wpkh = CScript() << OP_0 << vch20;
+    const CScript p2wsh = CScript() << OP_0 << vch32;
+    BOOST_CHECK_EQUAL(TestScript(p2wpkh, CLIENT_VERSION), 23U);
+    BOOST_CHECK_EQUAL(TestScript(p2wpkh, nWitness), 21U);
+    BOOST_CHECK_EQUAL(TestScript(p2wsh, CLIENT_VERSION), 35U);
+    BOOST_CHECK_EQUAL(TestScript(p2wsh, nWitness), 33U);
+
+    // Other scripts take as much either way.
+    const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << vch20 << OP_EQUALVERIFY << OP_CHECKSIG;
+    const CScript p2sh = CScript() << OP_HASH160 << vch20 << OP_EQUAL;
+    const CScript v1 = CScript() << OP_1 << vch32;
+    const CScript v0_other = CScript() << OP_0 << std::vector<unsigned char>(21, 0x42);
+    for (const CScript& script : {p2pkh, p2sh}) {
+        BOOST_CHECK_EQUAL(TestScript(script, CLIENT_VERSION), 21U);
+        BOOST_CHECK_EQUAL(TestScript(script, nWitness), 21U);
+    }
+    for (const CScript& script : {v1, v0_other, CScript(), CScript(std::vector<unsigned char>(200, OP_NOP))}) {
+        BOOST_CHECK_EQUAL(TestScript(script, CLIENT_VERSION), TestScript(script, nWitness));
+    }
+
+    // The two encodings differ for scripts that are not special.
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CScriptCompressor(REF(v1));
+    CScript read;
+    OverrideStream<CDataStream> os = WithOrVersion(&ss, SERIALIZE_COMPRESS_WITNESS_PROGRAMS);
+    os >> REF(CScriptCompressor(read));
+    BOOST_CHECK(read != v1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,16 +4,20 @@
 
 #include <crypto/aes.h>
 #include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/muhash.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <hash.h>
 #include <random.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -546,4 +550,88 @@ BOOST_AUTO_TEST_CASE(countbits_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = InsecureRandBits(8);
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+static uint256 FromMuHash(MuHash3072 acc)
+{
+    uint256 out;
+    acc.Finalize(out.begin());
+    return out;
+}
+
+static MuHash3072 MuHashElement(unsigned char i)
+{
+    unsigned char data[32] = {i};
+    MuHash3072 acc;
+    acc.Insert(data, sizeof(data));
+    return acc;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    unsigned char data0[32] = {0}, data1[32] = {1}, data2[32] = {2};
+
+    // Known answers, computed with an independent big integer implementation.
+    BOOST_CHECK_EQUAL(FromMuHash(MuHashElement(0)).GetHex(), "46b5948447d63bed8d4338aefb3a6d294f9550d830c7297d4b47858133e49a4d");
+    MuHash3072 acc;
+    acc.Insert(data0, 32).Insert(data1, 32).Remove(data2, 32);
+    BOOST_CHECK_EQUAL(FromMuHash(acc).GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // The hash does not depend on the order of updates, and removal undoes insertion.
+    MuHash3072 acc2;
+    acc2.Remove(data2, 32).Insert(data1, 32).Insert(data0, 32);
+    BOOST_CHECK(FromMuHash(acc) == FromMuHash(acc2));
+    acc2 *= MuHashElement(2);
+    acc2.Remove(data0, 32).Remove(data1, 32);
+    BOOST_CHECK(FromMuHash(acc2) == FromMuHash(MuHash3072()));
+
+    // A normalized state can be saved and continued from.
+    MuHash3072 acc3(acc.Normalize());
+    acc3.Insert(data2, 32);
+    acc.Insert(data2, 32);
+    BOOST_CHECK(FromMuHash(acc3) == FromMuHash(acc));
+    BOOST_CHECK(FromMuHash(acc3) == FromMuHash(MuHashElement(0) *= MuHashElement(1)));
+
+    // Encodings at or above the modulus are reduced, and p - 1 is its own inverse.
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    memset(bytes, 0xff, sizeof(bytes));
+    Num3072 x(bytes);
+    x.ToBytes(bytes);
+    BOOST_CHECK_EQUAL(ReadLE32(bytes), 1103716U);
+    BOOST_CHECK(std::all_of(bytes + 4, bytes + sizeof(bytes), [](unsigned char c) { return c == 0; }));
+    memset(bytes, 0xff, sizeof(bytes));
+    WriteLE32(bytes, 0xffffffffU - 1103716U - 1);
+    Num3072 minus_one(bytes);
+    minus_one.Multiply(minus_one);
+    minus_one.ToBytes(bytes);
+    BOOST_CHECK_EQUAL(ReadLE32(bytes), 1U);
+    BOOST_CHECK(std::all_of(bytes + 4, bytes + sizeof(bytes), [](unsigned char c) { return c == 0; }));
+
+    for (int i = 0; i < 10; ++i) {
+        for (size_t j = 0; j < sizeof(bytes); ++j) {
+            bytes[j] = InsecureRandBits(8);
+        }
+        Num3072 y(bytes), z(bytes);
+        z.Multiply(y.GetInverse());
+        unsigned char one[Num3072::BYTE_SIZE];
+        z.ToBytes(one);
+        BOOST_CHECK_EQUAL(one[0], 1);
+        BOOST_CHECK(std::all_of(one + 1, one + sizeof(one), [](unsigned char c) { return c == 0; }));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
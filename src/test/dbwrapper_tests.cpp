@@ -40,6 +40,91 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    DBProfile profile;
+    std::string error;
+    BOOST_CHECK(ApplyDBOptions({"txindex.bloombits=0", "chainstate.blocksize=65536", "txindex.compression=0", "txindex.maxopenfiles=1000", "txindex.subcompactions=3", "txindexx.bloombits=1"}, "txindex", profile, error));
+    BOOST_CHECK(!profile.compression);
+    BOOST_CHECK_EQUAL(profile.bloom_bits, 0);
+    BOOST_CHECK_EQUAL(profile.block_size, 4096U);
+    BOOST_CHECK_EQUAL(profile.max_open_files, 1000);
+    BOOST_CHECK_EQUAL(profile.max_subcompactions, 3);
+
+    // Compression is only accepted if LevelDB can compress.
+    BOOST_CHECK_EQUAL(ApplyDBOptions({"txindex.compression=1"}, "txindex", profile, error), leveldb::SnappyCompressionSupported());
+    BOOST_CHECK_EQUAL(profile.compression, leveldb::SnappyCompressionSupported());
+
+    // Malformed options are rejected whichever database they are for.
+    for (const char* option : {"txindex", "txindex.bloombits", "bloombits=1", "txindex.bloombits=x", "txindex.bloombits=65", "txindex.blocksize=100", "txindex.compression=2", "txindex.maxopenfiles=63", "txindex.maxopenfiles=1001", "txindex.subcompactions=0", "txindex.cache=1"}) {
+        BOOST_CHECK(!ApplyDBOptions({option}, "txindex", profile, error));
+        BOOST_CHECK(error.find(option) != std::string::npos);
+    }
+
+    // Databases work with every combination of settings.
+    for (bool compression : {false, true}) {
+        for (int bloom_bits : {0, 20}) {
+            profile.compression = compression;
+            profile.bloom_bits = bloom_bits;
+            profile.block_size = compression ? 65536 : 1024;
+            fs::path ph = fs::temp_directory_path() / fs::unique_path();
+            CDBWrapper dbw(ph, (1 << 20), true, false, false, profile);
+            for (uint32_t i = 0; i < 1000; i++) {
+                BOOST_CHECK(dbw.Write(i, uint256S(strprintf("%x", i))));
+            }
+            dbw.CompactRange(uint32_t{0}, uint32_t{1000});
+            uint256 res;
+            BOOST_CHECK(dbw.Read(uint32_t{123}, res));
+            BOOST_CHECK(res == uint256S("7b"));
+            BOOST_CHECK(!dbw.Read(uint32_t{1000}, res));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_subcompactions)
+{
+    // Write enough to the database for compactions to be split, with some
+    // keys overwritten or erased after they reached the lower levels.
+    DBProfile profile;
+    profile.max_subcompactions = 4;
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, profile);
+    const uint32_t nKeys = 40000;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < nKeys; i += 1000) {
+            CDBBatch batch(dbw);
+            for (uint32_t j = i; j < i + 1000; j++) {
+                if (pass == 0) {
+                    batch.Write(j, std::vector<unsigned char>(200, j % 251));
+                } else if (j % 7 == 0) {
+                    batch.Erase(j);
+                } else if (j % 3 == 0) {
+                    batch.Write(j, std::vector<unsigned char>(100, j % 13));
+                }
+            }
+            BOOST_CHECK(dbw.WriteBatch(batch));
+        }
+    }
+    dbw.CompactRange(uint32_t{0}, nKeys);
+
+    std::vector<unsigned char> res;
+    for (uint32_t i = 0; i < nKeys; i++) {
+        if (i % 7 == 0) {
+            BOOST_CHECK(!dbw.Exists(i));
+        } else {
+            BOOST_CHECK(dbw.Read(i, res));
+            BOOST_CHECK(res == (i % 3 == 0 ? std::vector<unsigned char>(100, i % 13) : std::vector<unsigned char>(200, i % 251)));
+        }
+    }
+    size_t nCount = 0;
+    std::unique_ptr<CDBIterator> it(dbw.NewIterator());
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        nCount++;
+    }
+    BOOST_CHECK_EQUAL(nCount, nKeys - (nKeys + 6) / 7);
+    BOOST_CHECK(dbw.DynamicMemoryUsage() > 0);
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
@@ -0,0 +1,124 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <memusage.h>
+#include <support/allocators/pool.h>
+#include <test/test_bitcoin.h>
+
+#include <set>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_allocate)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks are rounded up to the alignment, and carved from one chunk.
+    std::set<uintptr_t> blocks;
+    for (int i = 0; i < 10; i++) {
+        void* p = resource.Allocate(20, 8);
+        BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(p) % 8, 0U);
+        BOOST_CHECK(blocks.insert(reinterpret_cast<uintptr_t>(p)).second);
+    }
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 10 * 24U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // A freed block is the next one handed out for its size only.
+    void* p = reinterpret_cast<void*>(*blocks.begin());
+    resource.Deallocate(p, 20, 8);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 9 * 24U);
+    void* q = resource.Allocate(32, 8);
+    BOOST_CHECK(q != p);
+    BOOST_CHECK(resource.Allocate(17, 8) == p);
+    resource.Deallocate(q, 32, 8);
+
+    // Blocks that are too large or too aligned come from the heap.
+    void* large = resource.Allocate(65, 8);
+    void* aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 10 * 24U);
+    resource.Deallocate(large, 65, 8);
+    resource.Deallocate(aligned, 8, 16);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_chunks)
+{
+    PoolResource<64, 8> resource(1024);
+    char* first = static_cast<char*>(resource.Allocate(24, 8));
+    for (int i = 1; i < 42; i++) {
+        BOOST_CHECK(resource.Allocate(24, 8) == first + 24 * i);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // A block that does not fit starts a new chunk, and the 16 bytes left of
+    // the first one can still be allocated.
+    resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK(resource.Allocate(16, 8) == first + 24 * 42);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 43 * 24U + 16);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_unordered_map)
+{
+    typedef PoolAllocator<std::pair<const uint64_t, uint64_t>, 64> Allocator;
+    typedef std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, Allocator> Map;
+    Allocator::ResourceType resource(4096);
+    Map map(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), Allocator(&resource));
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+
+    for (uint64_t i = 0; i < 1000; i++) {
+        map.emplace(i, i * 2);
+    }
+    const size_t nChunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(nChunks > 0);
+    BOOST_CHECK_EQUAL(resource.UsedBytes() % map.size(), 0U);
+    const size_t nNodeBytes = resource.UsedBytes() / map.size();
+    BOOST_CHECK(nNodeBytes <= 64);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nChunks * memusage::MallocUsage(4096) + memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+    for (uint64_t i = 0; i < 1000; i++) {
+        BOOST_CHECK_EQUAL(map.at(i), i * 2);
+    }
+
+    // Erased nodes leave the pool's used bytes, and their memory is reused.
+    for (uint64_t i = 0; i < 500; i++) {
+        map.erase(i);
+    }
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), nNodeBytes * 500);
+    for (uint64_t i = 1000; i < 1500; i++) {
+        map.emplace(i, i * 2);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+
+    map.clear();
+    BOOST_CHECK_EQUAL(resource.UsedBytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_coins_map)
+{
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map = MakeCoinsMap(resource);
+    for (uint32_t i = 0; i < 100; i++) {
+        map.emplace(COutPoint(InsecureRand256(), i), CCoinsCacheEntry());
+    }
+    // Every node is pooled, and takes less than a malloc would.
+    BOOST_CHECK_EQUAL(resource.UsedBytes() % map.size(), 0U);
+    const size_t nNodeBytes = resource.UsedBytes() / map.size();
+    BOOST_CHECK(nNodeBytes < memusage::MallocUsage(nNodeBytes));
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), resource.NumAllocatedChunks() * memusage::MallocUsage(resource.ChunkSizeBytes()) + memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+
+    // Erased nodes are still counted, as the pool keeps their memory.
+    const size_t nUsage = memusage::DynamicUsage(map);
+    map.erase(map.begin());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
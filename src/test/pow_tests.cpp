@@ -7,6 +7,7 @@
 #include <pow.h>
 #include <random.h>
 #include <util.h>
+#include <validation.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
@@ -83,4 +84,27 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(check_block_headers, TestingSetup)
+{
+    // Large batches are shared with the header checking threads.
+    // Regtest targets are met by about half of all hashes, so a batch of
+    // random headers has headers on both sides of the check.
+    const auto chainParams = CreateChainParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    for (size_t nHeaders : {0, 1, 100, 2000}) {
+        std::vector<CBlockHeader> headers(nHeaders);
+        for (CBlockHeader& header : headers) {
+            header.nBits = 0x207fffff;
+            header.nNonce = InsecureRand32();
+        }
+        const HeaderChecks checks = CheckBlockHeaders(headers, params);
+        BOOST_REQUIRE_EQUAL(checks.hashes.size(), nHeaders);
+        BOOST_REQUIRE_EQUAL(checks.valid_pow.size(), nHeaders);
+        for (size_t i = 0; i < nHeaders; i++) {
+            BOOST_CHECK(checks.hashes[i] == headers[i].GetHash());
+            BOOST_CHECK_EQUAL(bool(checks.valid_pow[i]), CheckProofOfWork(headers[i].GetHash(), headers[i].nBits, params));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
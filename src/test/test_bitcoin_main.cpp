@@ -6,6 +6,8 @@
 
 #include <net.h>
 
+#include <atomic>
+
 #include <boost/test/unit_test.hpp>
 
 std::unique_ptr<CConnman> g_connman;
@@ -15,12 +17,19 @@ std::unique_ptr<CConnman> g_connman;
   std::exit(EXIT_SUCCESS);
 }
 
-[[noreturn]] void StartShutdown()
+static std::atomic<bool> fRequestShutdown(false);
+
+void StartShutdown()
 {
-  std::exit(EXIT_SUCCESS);
+  fRequestShutdown = true;
+}
+
+void AbortShutdown()
+{
+  fRequestShutdown = false;
 }
 
 bool ShutdownRequested()
 {
-  return false;
+  return fRequestShutdown;
 }
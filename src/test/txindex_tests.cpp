@@ -0,0 +1,131 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <index/txindex.h>
+#include <init.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txindex_tests)
+
+BOOST_FIXTURE_TEST_CASE(txindex_initial_sync, TestChain100Setup)
+{
+    TxIndex txindex(MakeUnique<TxIndexDB>(1 << 20, true));
+
+    CTransactionRef tx_disk;
+    uint256 block_hash;
+
+    // Transaction should not be found in the index before it is started.
+    for (const auto& txn : coinbaseTxns) {
+        BOOST_CHECK(!txindex.FindTx(txn.GetHash(), block_hash, tx_disk));
+    }
+
+    // BlockUntilSyncedToCurrentChain should return false before txindex is started.
+    BOOST_CHECK(!txindex.BlockUntilSyncedToCurrentChain());
+
+    txindex.Start();
+
+    // Allow tx index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!txindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // Check that txindex has all txs that were in the chain before it started.
+    for (const auto& txn : coinbaseTxns) {
+        if (!txindex.FindTx(txn.GetHash(), block_hash, tx_disk)) {
+            BOOST_ERROR("FindTx failed");
+        } else if (tx_disk->GetHash() != txn.GetHash()) {
+            BOOST_ERROR("Read incorrect tx");
+        }
+    }
+
+    // Check that new transactions in new blocks make it into the index.
+    for (int i = 0; i < 10; i++) {
+        CScript coinbase_script_pub_key = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+        std::vector<CMutableTransaction> no_txns;
+        const CBlock& block = CreateAndProcessBlock(no_txns, coinbase_script_pub_key);
+        const CTransaction& txn = *block.vtx[0];
+
+        BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+        if (!txindex.FindTx(txn.GetHash(), block_hash, tx_disk)) {
+            BOOST_ERROR("FindTx failed");
+        } else if (tx_disk->GetHash() != txn.GetHash()) {
+            BOOST_ERROR("Read incorrect tx");
+        } else {
+            BOOST_CHECK(block_hash == block.GetHash());
+        }
+    }
+
+    txindex.Stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(txindex_restart_mid_sync, TestChain100Setup)
+{
+    constexpr int64_t timeout_ms = 10 * 1000;
+    {
+        TxIndex txindex(MakeUnique<TxIndexDB>(1 << 20, false, true));
+        txindex.Start();
+        int64_t time_start = GetTimeMillis();
+        while (!txindex.BlockUntilSyncedToCurrentChain()) {
+            BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+            MilliSleep(100);
+        }
+        txindex.Stop();
+    }
+
+    // Connect two blocks while the index is stopped, and make the first
+    // unreadable, so that the next sync stops right after it starts, as if
+    // the node crashed there.
+    CScript coinbase_script_pub_key = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    const CBlock block_missing = CreateAndProcessBlock({}, coinbase_script_pub_key);
+    CreateAndProcessBlock({}, coinbase_script_pub_key);
+    CBlockIndex* pindex_missing;
+    {
+        LOCK(cs_main);
+        pindex_missing = chainActive[101];
+        pindex_missing->nStatus &= ~BLOCK_HAVE_DATA;
+    }
+    {
+        TxIndex txindex(MakeUnique<TxIndexDB>(1 << 20, false, false));
+        txindex.Start();
+        int64_t time_start = GetTimeMillis();
+        while (!ShutdownRequested()) {
+            BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+            MilliSleep(10);
+        }
+        txindex.Stop();
+    }
+    AbortShutdown();
+    {
+        LOCK(cs_main);
+        pindex_missing->nStatus |= BLOCK_HAVE_DATA;
+    }
+
+    // The index resumes from the last block it wrote, so the transactions of
+    // the block it failed on are indexed after the restart.
+    TxIndex txindex(MakeUnique<TxIndexDB>(1 << 20, false, false));
+    txindex.Start();
+    int64_t time_start = GetTimeMillis();
+    while (!txindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(!ShutdownRequested());
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+    CTransactionRef tx_disk;
+    uint256 block_hash;
+    BOOST_CHECK(txindex.FindTx(block_missing.vtx[0]->GetHash(), block_hash, tx_disk));
+    BOOST_CHECK(block_hash == block_missing.GetHash());
+    txindex.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,16 +13,24 @@
 #include <util.h>
 #include <ui_interface.h>
 #include <init.h>
+#include <memusage.h>
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <deque>
+#include <future>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_TXINDEX_BLOCK = 'T';
+static const char DB_COINSTATS = 's';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'S';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
@@ -30,8 +38,68 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
+static const char* const DB_PROFILE_NAMES[] = {"blockindex", "chainstate", "txindex", "coinstatsindex"};
+
+DBProfile GetDBProfile(const std::string& name)
+{
+    DBProfile profile;
+    if (name == "chainstate") {
+        // Coins flushes write much more than anything else, and writes stall
+        // when compactions fall behind them.
+        profile.max_subcompactions = std::min(GetNumCores(), 4);
+    }
+    std::string error;
+    if (!ApplyDBOptions(gArgs.GetArgs("-dboption"), name, profile, error)) {
+        // Checked by CheckDBOptions at startup.
+        LogPrintf("%s\n", error);
+    }
+    return profile;
+}
+
+bool CheckDBOptions(std::string& error)
+{
+    const std::vector<std::string> options = gArgs.GetArgs("-dboption");
+    for (const std::string& option : options) {
+        const std::string name = option.substr(0, option.find('.'));
+        if (std::find(std::begin(DB_PROFILE_NAMES), std::end(DB_PROFILE_NAMES), name) == std::end(DB_PROFILE_NAMES)) {
+            error = strprintf("Unknown database in database option %s", option);
+            return false;
+        }
+    }
+    for (const char* name : DB_PROFILE_NAMES) {
+        DBProfile profile;
+        if (!ApplyDBOptions(options, name, profile, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int GetDBExtraFileDescriptors()
+{
+    int nExtra = 0;
+    for (const char* name : DB_PROFILE_NAMES) {
+        nExtra += std::max(0, GetDBProfile(name).max_open_files - DBProfile().max_open_files);
+    }
+    return nExtra;
+}
+
 namespace {
 
+/**
+ * Lowest hash of the nPart-th of nParts ranges of equal width, delimited by the
+ * first two bytes of the serialized hash. Keys made of a prefix and a hash are
+ * ordered by those bytes first, so each range maps to a contiguous key range.
+ */
+uint256 GetHashRangeBegin(unsigned int nPart, unsigned int nParts)
+{
+    const uint32_t nPrefix = (uint64_t)0x10000 * nPart / nParts;
+    uint256 hash;
+    hash.begin()[0] = nPrefix >> 8;
+    hash.begin()[1] = nPrefix & 0xff;
+    return hash;
+}
+
 struct CoinEntry {
     COutPoint* outpoint;
     char key;
@@ -54,15 +122,21 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, GetDBProfile("chainstate")) 
 {
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (m_filter && !m_filter->MayContain(outpoint)) {
+        return false;
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    if (m_filter && !m_filter->MayContain(outpoint)) {
+        return false;
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
@@ -109,15 +183,19 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
-            if (it->second.coin.IsSpent())
+            if (it->second.coin.IsSpent()) {
                 batch.Erase(entry);
-            else
+            } else {
+                // Added before the write, so the coin never seems missing once it is there.
+                if (m_filter) m_filter->Insert(it->first);
                 batch.Write(entry, it->second.coin);
+            }
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        // Entries are left in place: CCoinsViewAsyncFlush keeps serving
+        // reads from mapCoins while this runs in the background.
+        ++it;
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -139,6 +217,9 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    if (m_filter && m_filter->GetInserted() > m_filter->GetCapacity() && !m_filter_full.exchange(true)) {
+        LogPrintf("UTXO set filter is over capacity and lets more lookups of missing coins through; it is rebuilt on restart\n");
+    }
     return ret;
 }
 
@@ -147,7 +228,177 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+bool CCoinsViewDB::WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin>>& coins, const uint256& hashBlock)
+{
+    CDBBatch batch(db);
+    if (GetHeadBlocks().empty()) {
+        // As in BatchWrite, an interrupted load leaves the database marked as
+        // being in the middle of a transition to hashBlock.
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, GetBestBlock()});
+    }
+    for (const auto& entry : coins) {
+        if (m_filter) m_filter->Insert(entry.first);
+        batch.Write(CoinEntry(&entry.first), entry.second);
+    }
+    LogPrint(BCLog::COINDB, "Writing snapshot batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::LoadFilter(size_t nSizeBytes)
+{
+    const int64_t nStart = GetTimeMillis();
+    std::unique_ptr<CoinsFilter> filter(new CoinsFilter(nSizeBytes));
+    std::unique_ptr<CCoinsViewCursor> pcursor(Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            return false;
+        }
+        COutPoint key;
+        if (pcursor->GetKey(key)) {
+            filter->Insert(key);
+        }
+    }
+    LogPrintf("Loaded %u coins into %.1fMiB UTXO set filter (capacity %u) in %dms\n",
+        filter->GetInserted(), filter->DynamicMemoryUsage() * (1.0 / 1024 / 1024), filter->GetCapacity(), GetTimeMillis() - nStart);
+    m_filter = std::move(filter);
+    m_filter_full = false;
+    return true;
+}
+
+bool CCoinsViewDB::FinishSnapshot(const uint256& hashBlock)
+{
+    CDBBatch batch(db);
+    batch.Erase(DB_HEAD_BLOCKS);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    return db.WriteBatch(batch, true);
+}
+
+CCoinsViewAsyncFlush::~CCoinsViewAsyncFlush()
+{
+    try {
+        if (!Sync()) {
+            LogPrintf("%s: Failed to write to coin database\n", __func__);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Failed to write to coin database: %s\n", __func__, e.what());
+    }
+}
+
+bool CCoinsViewAsyncFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    CCoinsMap::const_iterator it = m_flushing->find(outpoint);
+    if (it != m_flushing->end()) {
+        coin = it->second.coin;
+        return !coin.IsSpent();
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewAsyncFlush::HaveCoin(const COutPoint &outpoint) const
+{
+    CCoinsMap::const_iterator it = m_flushing->find(outpoint);
+    if (it != m_flushing->end()) {
+        return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewAsyncFlush::GetBestBlock() const
+{
+    if (!m_flushing_block.IsNull()) {
+        return m_flushing_block;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewAsyncFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    if (!Sync()) {
+        return false;
+    }
+
+    // Only dirty entries differ from the base view, so there is no need to
+    // keep the rest around while writing.
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            m_flushing->emplace(it->first, std::move(it->second));
+        }
+    }
+    return StartWrite(hashBlock);
+}
+
+bool CCoinsViewAsyncFlush::BatchWriteMove(PooledCoinsMap &coins, const uint256 &hashBlock)
+{
+    if (!Sync()) {
+        return false;
+    }
+
+    m_flushing = std::move(coins);
+    coins = PooledCoinsMap();
+    return StartWrite(hashBlock);
+}
+
+bool CCoinsViewAsyncFlush::StartWrite(const uint256 &hashBlock)
+{
+    m_flushing_coins_usage = 0;
+    for (const auto& entry : *m_flushing) {
+        m_flushing_coins_usage += entry.second.coin.DynamicMemoryUsage();
+    }
+    m_flushing_block = hashBlock;
+
+    LogPrint(BCLog::COINDB, "Writing %u transaction outputs to coin database in the background\n", (unsigned int)m_flushing->size());
+    try {
+        m_write = std::async(std::launch::async, [this] {
+            RenameThread("bitcoin-coinsflush");
+            int64_t nStart = GetTimeMicros();
+            bool ret = base->BatchWrite(*m_flushing, m_flushing_block);
+            LogPrint(BCLog::BENCH, "    - Background coins flush: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+            return ret;
+        });
+    } catch (const std::system_error& e) {
+        // Could not start a thread; write synchronously instead.
+        LogPrintf("%s: %s, flushing synchronously\n", __func__, e.what());
+        bool ret = base->BatchWrite(*m_flushing, m_flushing_block);
+        ResetFlushing();
+        return ret;
+    }
+    return true;
+}
+
+bool CCoinsViewAsyncFlush::Sync(bool fWait)
+{
+    if (!m_write.valid()) {
+        return true;
+    }
+    if (!fWait && m_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return true;
+    }
+    bool ret = false;
+    try {
+        ret = m_write.get();
+    } catch (...) {
+        ResetFlushing();
+        throw;
+    }
+    ResetFlushing();
+    return ret;
+}
+
+size_t CCoinsViewAsyncFlush::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(*m_flushing) + m_flushing_coins_usage;
+}
+
+void CCoinsViewAsyncFlush::ResetFlushing()
+{
+    m_flushing = PooledCoinsMap();
+    m_flushing_coins_usage = 0;
+    m_flushing_block.SetNull();
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, GetDBProfile("blockindex")) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -176,16 +427,55 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
-    // Cache key of first record
-    if (i->pcursor->Valid()) {
-        CoinEntry entry(&i->keyTmp.second);
-        i->pcursor->GetKey(entry);
-        i->keyTmp.first = entry.key;
+    i->Seek(uint256());
+    return i;
+}
+
+std::vector<std::unique_ptr<CCoinsViewCursor>> CCoinsViewDB::Cursors(unsigned int nParts) const
+{
+    assert(nParts > 0);
+    CDBWrapper& dbw = const_cast<CDBWrapper&>(db);
+    const std::shared_ptr<const leveldb::Snapshot> snapshot = dbw.GetSnapshot();
+
+    // Read the best block from the snapshot too, so it matches the coins.
+    uint256 hashBestChain;
+    {
+        std::unique_ptr<CDBIterator> pcursor(dbw.NewIterator(snapshot));
+        pcursor->Seek(DB_BEST_BLOCK);
+        char key;
+        if (!pcursor->Valid() || !pcursor->GetKey(key) || key != DB_BEST_BLOCK || !pcursor->GetValue(hashBestChain)) {
+            hashBestChain.SetNull();
+        }
+    }
+
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors;
+    for (unsigned int nPart = 0; nPart < nParts; nPart++) {
+        CCoinsViewDBCursor *i;
+        if (nPart + 1 == nParts) {
+            i = new CCoinsViewDBCursor(dbw.NewIterator(snapshot), hashBestChain);
+        } else {
+            i = new CCoinsViewDBCursor(dbw.NewIterator(snapshot), hashBestChain, GetHashRangeBegin(nPart + 1, nParts));
+        }
+        i->Seek(GetHashRangeBegin(nPart, nParts));
+        cursors.emplace_back(i);
+    }
+    return cursors;
+}
+
+void CCoinsViewDBCursor::Seek(const uint256 &hashBegin)
+{
+    pcursor->Seek(std::make_pair(DB_COIN, hashBegin));
+    ReadKey();
+}
+
+void CCoinsViewDBCursor::ReadKey()
+{
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || (fHasEnd && !(keyTmp.second.hash < hashEnd))) {
+        keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
     } else {
-        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+        keyTmp.first = entry.key;
     }
-    return i;
 }
 
 bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
@@ -216,12 +506,7 @@ bool CCoinsViewDBCursor::Valid() const
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    CoinEntry entry(&keyTmp.second);
-    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
-        keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
-    } else {
-        keyTmp.first = entry.key;
-    }
+    ReadKey();
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -233,20 +518,13 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // Any block index snapshot is now out of date.
+    if (!blockinfo.empty()) {
+        batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
+    }
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(std::make_pair(DB_TXINDEX, txid), pos);
-}
-
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
-}
-
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -259,49 +537,241 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+namespace {
+
+/** A block index entry as read from disk, and the hash of its header. */
+struct BlockIndexEntry
 {
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    uint256 hash;
+    CDiskBlockIndex diskindex;
+};
 
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+typedef std::vector<BlockIndexEntry> BlockIndexEntries;
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+} // namespace
+
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+/** Number of entries per chunk of a block index snapshot */
+static const size_t BLOCK_INDEX_SNAPSHOT_CHUNK_ENTRIES = 10000;
+/** Upper bound on the size of a chunk of a block index snapshot */
+static const uint64_t MAX_BLOCK_INDEX_SNAPSHOT_CHUNK_SIZE = 32 << 20;
+
+/** Compute the hash of each entry and check its proof of work. */
+static bool HashBlockIndexEntries(BlockIndexEntries& entries, const Consensus::Params& consensusParams)
+{
+    for (BlockIndexEntry& entry : entries) {
+        entry.hash = entry.diskindex.GetBlockHash();
+        if (!CheckProofOfWork(entry.hash, entry.diskindex.nBits, consensusParams))
+            return error("%s: CheckProofOfWork failed: %s", __func__, entry.hash.ToString());
+    }
+    return true;
+}
+
+/** Read the block index entries in a range of block hashes from the database. */
+static bool ReadBlockIndexRange(CDBIterator& cursor, const uint256& hashBegin, const uint256* phashEnd,
+                                const Consensus::Params& consensusParams, BlockIndexEntries& entries)
+{
+    cursor.Seek(std::make_pair(DB_BLOCK_INDEX, hashBegin));
+    while (cursor.Valid()) {
         std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
+        if (!cursor.GetKey(key) || key.first != DB_BLOCK_INDEX || (phashEnd && !(key.second < *phashEnd))) {
+            break;
+        }
+        BlockIndexEntry entry;
+        if (!cursor.GetValue(entry.diskindex)) {
+            return error("%s: failed to read value", __func__);
+        }
+        entries.push_back(std::move(entry));
+        cursor.Next();
+    }
+    return HashBlockIndexEntries(entries, consensusParams);
+}
+
+/** Deserialize and check a chunk of a block index snapshot. Throws on failure. */
+static BlockIndexEntries ReadBlockIndexSnapshotChunk(CDataStream chunk, uint256 hashChunk, const Consensus::Params& consensusParams)
+{
+    if (Hash(chunk.begin(), chunk.end()) != hashChunk) {
+        throw std::ios_base::failure("chunk checksum mismatch");
+    }
+    BlockIndexEntries entries;
+    while (!chunk.empty()) {
+        entries.emplace_back();
+        chunk >> entries.back().diskindex;
+    }
+    if (!HashBlockIndexEntries(entries, consensusParams)) {
+        throw std::ios_base::failure("invalid entry");
+    }
+    return entries;
+}
+
+/**
+ * Read the block index entries from a snapshot, provided it is the one the
+ * database marks as matching its contents. Chunks are checked in parallel.
+ */
+static bool ReadBlockIndexSnapshot(const fs::path& path, const std::pair<uint256, uint64_t>& marker,
+                                   const Consensus::Params& consensusParams, std::vector<BlockIndexEntries>& parts)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return error("%s: unable to open %s", __func__, path.string());
+    }
+    try {
+        uint32_t nVersion;
+        uint256 nonce;
+        file >> nVersion;
+        file >> nonce;
+        if (nVersion != BLOCK_INDEX_SNAPSHOT_VERSION || nonce != marker.first) {
+            return error("%s: %s does not match the block index database", __func__, path.string());
+        }
+
+        const size_t nMaxPending = std::max(1, GetNumCores());
+        std::deque<std::future<BlockIndexEntries>> pending;
+        uint64_t nEntries = 0;
+        bool fEnd = false;
+        while (!fEnd || !pending.empty()) {
+            if (!fEnd && pending.size() < nMaxPending) {
+                uint64_t nSize = ReadCompactSize(file);
+                if (nSize == 0) {
+                    fEnd = true;
+                    continue;
+                }
+                if (nSize > MAX_BLOCK_INDEX_SNAPSHOT_CHUNK_SIZE) {
+                    throw std::ios_base::failure("oversized chunk");
+                }
+                CDataStream chunk(SER_DISK, CLIENT_VERSION);
+                chunk.resize(nSize);
+                file.read(chunk.data(), nSize);
+                uint256 hashChunk;
+                file >> hashChunk;
+                pending.push_back(std::async(std::launch::async, ReadBlockIndexSnapshotChunk, std::move(chunk), hashChunk, std::cref(consensusParams)));
+                continue;
             }
+            parts.push_back(pending.front().get());
+            pending.pop_front();
+            nEntries += parts.back().size();
+        }
+        if (nEntries != marker.second) {
+            return error("%s: %s has %u entries, expected %u", __func__, path.string(), nEntries, marker.second);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: unable to read %s: %s", __func__, path.string(), e.what());
+    }
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+                                      std::function<void(size_t)> reserveBlockIndex, const fs::path& snapshotPath)
+{
+    std::vector<BlockIndexEntries> parts;
+    std::pair<uint256, uint64_t> marker;
+    bool fFromSnapshot = false;
+    if (!snapshotPath.empty() && !Read(DB_BLOCK_INDEX_SNAPSHOT, marker)) {
+        LogPrintf("No block index snapshot matches the database, loading block index from the database\n");
+    } else if (!snapshotPath.empty()) {
+        fFromSnapshot = ReadBlockIndexSnapshot(snapshotPath, marker, consensusParams, parts);
+        if (fFromSnapshot) {
+            LogPrintf("Loading block index from snapshot %s\n", snapshotPath.string());
         } else {
-            break;
+            LogPrintf("Block index snapshot %s is not usable, loading block index from the database\n", snapshotPath.string());
+            parts.clear();
+        }
+    }
+
+    if (!fFromSnapshot) {
+        // Split the entries into ranges of block hashes, each read from its
+        // own iterator over a shared snapshot of the database.
+        const unsigned int nParts = std::max(1, GetNumCores());
+        const std::shared_ptr<const leveldb::Snapshot> snapshot = GetSnapshot();
+        parts.resize(nParts);
+        std::vector<std::future<bool>> results;
+        for (unsigned int nPart = 0; nPart < nParts; nPart++) {
+            results.push_back(std::async(std::launch::async, [&, nPart] {
+                std::unique_ptr<CDBIterator> pcursor(NewIterator(snapshot));
+                const uint256 hashEnd = GetHashRangeBegin(nPart + 1, nParts);
+                return ReadBlockIndexRange(*pcursor, GetHashRangeBegin(nPart, nParts), nPart + 1 < nParts ? &hashEnd : nullptr,
+                                           consensusParams, parts[nPart]);
+            }));
+        }
+        bool fOk = true;
+        for (std::future<bool>& result : results) {
+            fOk &= result.get();
+        }
+        if (!fOk) {
+            return false;
+        }
+    }
+
+    boost::this_thread::interruption_point();
+
+    // Insert the entries in height order, so that blocks are created before
+    // their descendants and close to their ancestors in memory.
+    std::vector<const BlockIndexEntry*> vSorted;
+    for (const BlockIndexEntries& entries : parts) {
+        for (const BlockIndexEntry& entry : entries) {
+            vSorted.push_back(&entry);
         }
     }
+    std::sort(vSorted.begin(), vSorted.end(), [](const BlockIndexEntry* a, const BlockIndexEntry* b) {
+        return a->diskindex.nHeight < b->diskindex.nHeight;
+    });
+    reserveBlockIndex(vSorted.size());
+
+    // Load mapBlockIndex
+    for (const BlockIndexEntry* entry : vSorted) {
+        const CDiskBlockIndex& diskindex = entry->diskindex;
+        // Construct block index object
+        CBlockIndex* pindexNew = insertBlockIndex(entry->hash);
+        pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+        pindexNew->nHeight        = diskindex.nHeight;
+        pindexNew->nFile          = diskindex.nFile;
+        pindexNew->nDataPos       = diskindex.nDataPos;
+        pindexNew->nUndoPos       = diskindex.nUndoPos;
+        pindexNew->nVersion       = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->nTime          = diskindex.nTime;
+        pindexNew->nBits          = diskindex.nBits;
+        pindexNew->nNonce         = diskindex.nNonce;
+        pindexNew->nStatus        = diskindex.nStatus;
+        pindexNew->nTx            = diskindex.nTx;
+    }
 
     return true;
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const fs::path& snapshotPath, const std::vector<const CBlockIndex*>& blockinfo)
+{
+    // The nonce ties the snapshot to the marker written to the database.
+    const uint256 nonce = GetRandHash();
+    const fs::path pathTmp = snapshotPath.string() + ".new";
+    try {
+        CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            return error("%s: unable to open %s", __func__, pathTmp.string());
+        }
+        file << BLOCK_INDEX_SNAPSHOT_VERSION;
+        file << nonce;
+        CDataStream chunk(SER_DISK, CLIENT_VERSION);
+        for (size_t i = 0; i < blockinfo.size(); i++) {
+            chunk << CDiskBlockIndex(blockinfo[i]);
+            if ((i + 1) % BLOCK_INDEX_SNAPSHOT_CHUNK_ENTRIES == 0 || i + 1 == blockinfo.size()) {
+                WriteCompactSize(file, chunk.size());
+                file.write(chunk.data(), chunk.size());
+                file << Hash(chunk.begin(), chunk.end());
+                chunk.clear();
+            }
+        }
+        WriteCompactSize(file, 0);
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, snapshotPath)) {
+            return error("%s: unable to rename %s", __func__, pathTmp.string());
+        }
+    } catch (const std::exception& e) {
+        return error("%s: unable to write %s: %s", __func__, pathTmp.string(), e.what());
+    }
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, std::make_pair(nonce, (uint64_t)blockinfo.size()), true);
+}
+
 namespace {
 
 //! Legacy class to deserialize pre-pertxout database entries without reindex.
@@ -424,3 +894,191 @@ bool CCoinsViewDB::Upgrade() {
     LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
     return !ShutdownRequested();
 }
+
+BaseIndexDB::BaseIndexDB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, const DBProfile& profile) :
+    CDBWrapper(path, n_cache_size, f_memory, f_wipe, false, profile)
+{}
+
+bool BaseIndexDB::ReadBestBlock(CBlockLocator& locator) const
+{
+    bool success = Read(DB_BEST_BLOCK, locator);
+    if (!success) {
+        locator.SetNull();
+    }
+    return success;
+}
+
+bool BaseIndexDB::WriteBestBlock(const CBlockLocator& locator)
+{
+    return Write(DB_BEST_BLOCK, locator);
+}
+
+TxIndexDB::TxIndexDB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndexDB(GetDataDir() / "indexes" / "txindex", n_cache_size, f_memory, f_wipe, GetDBProfile("txindex"))
+{}
+
+bool TxIndexDB::ReadTxPos(const uint256 &txid, CDiskTxPos& pos) const
+{
+    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+}
+
+bool TxIndexDB::WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos>>& v_pos)
+{
+    CDBBatch batch(*this);
+    for (const auto& tuple : v_pos) {
+        batch.Write(std::make_pair(DB_TXINDEX, tuple.first), tuple.second);
+    }
+    return WriteBatch(batch);
+}
+
+/*
+ * Safely persist a transfer of data from the old txindex database to the new one, and compact the
+ * range of keys updated. This is used internally by MigrateData.
+ */
+static void WriteTxIndexMigrationBatches(TxIndexDB& newdb, CBlockTreeDB& olddb,
+                                         CDBBatch& batch_newdb, CDBBatch& batch_olddb,
+                                         const std::pair<char, uint256>& begin_key,
+                                         const std::pair<char, uint256>& end_key)
+{
+    // Sync new DB changes to disk before deleting from old DB.
+    newdb.WriteBatch(batch_newdb, /*fSync=*/ true);
+    olddb.WriteBatch(batch_olddb);
+    olddb.CompactRange(begin_key, end_key);
+
+    batch_newdb.Clear();
+    batch_olddb.Clear();
+}
+
+bool TxIndexDB::MigrateData(CBlockTreeDB& block_tree_db, const CBlockLocator& best_locator)
+{
+    // The prior implementation of txindex was always in sync with block index
+    // and presence was indicated with a boolean DB flag. If the flag is set,
+    // this means the txindex from a previous version is valid and in sync with
+    // the chain tip. The first step of the migration is to unset the flag and
+    // write the chain hash to a separate key, DB_TXINDEX_BLOCK. After that, the
+    // index entries are copied over in batches to the new database. Finally,
+    // DB_TXINDEX_BLOCK is erased from the old database and the block hash is
+    // written to the new database.
+    //
+    // Unsetting the boolean flag ensures that if the node is downgraded to a
+    // previous version, it will not see a corrupted, partially migrated index
+    // -- it will see that the txindex is disabled. When the node is upgraded
+    // again, the migration will pick up where it left off and sync to the block
+    // with hash DB_TXINDEX_BLOCK.
+    bool f_legacy_flag = false;
+    block_tree_db.ReadFlag("txindex", f_legacy_flag);
+    if (f_legacy_flag) {
+        if (!block_tree_db.Write(DB_TXINDEX_BLOCK, best_locator)) {
+            return error("%s: cannot write block indicator", __func__);
+        }
+        if (!block_tree_db.WriteFlag("txindex", false)) {
+            return error("%s: cannot write block index db flag", __func__);
+        }
+    }
+
+    CBlockLocator locator;
+    if (!block_tree_db.Read(DB_TXINDEX_BLOCK, locator)) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading txindex database... [0%%]\n");
+    uiInterface.ShowProgress(_("Upgrading txindex database"), 0, true);
+    int report_done = 0;
+    const size_t batch_size = 1 << 24; // 16 MiB
+
+    CDBBatch batch_newdb(*this);
+    CDBBatch batch_olddb(block_tree_db);
+
+    std::pair<char, uint256> key;
+    std::pair<char, uint256> begin_key{DB_TXINDEX, uint256()};
+    std::pair<char, uint256> prev_key = begin_key;
+
+    bool interrupted = false;
+    std::unique_ptr<CDBIterator> cursor(block_tree_db.NewIterator());
+    for (cursor->Seek(begin_key); cursor->Valid(); cursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            interrupted = true;
+            break;
+        }
+
+        if (!cursor->GetKey(key)) {
+            return error("%s: cannot get key from valid cursor", __func__);
+        }
+        if (key.first != DB_TXINDEX) {
+            break;
+        }
+
+        // Log progress every 10%.
+        if (++count % 256 == 0) {
+            // Since txids are uniformly random and traversed in increasing order, the high 16 bits
+            // of the hash can be used to estimate the current progress.
+            const uint256& txid = key.second;
+            uint32_t high_nibble =
+                (static_cast<uint32_t>(*(txid.begin() + 0)) << 8) +
+                (static_cast<uint32_t>(*(txid.begin() + 1)) << 0);
+            int percentage_done = (int)(high_nibble * 100.0 / 65536.0 + 0.5);
+
+            uiInterface.ShowProgress(_("Upgrading txindex database"), percentage_done, true);
+            if (report_done < percentage_done/10) {
+                LogPrintf("Upgrading txindex database... [%d%%]\n", percentage_done);
+                report_done = percentage_done/10;
+            }
+        }
+
+        CDiskTxPos value;
+        if (!cursor->GetValue(value)) {
+            return error("%s: cannot parse txindex record", __func__);
+        }
+        batch_newdb.Write(key, value);
+        batch_olddb.Erase(key);
+
+        if (batch_newdb.SizeEstimate() > batch_size || batch_olddb.SizeEstimate() > batch_size) {
+            // NOTE: it's OK to delete the key pointed at by the current DB cursor while iterating
+            // because LevelDB iterators are guaranteed to provide a consistent view of the
+            // underlying data, like a lightweight snapshot.
+            WriteTxIndexMigrationBatches(*this, block_tree_db,
+                                         batch_newdb, batch_olddb,
+                                         prev_key, key);
+            prev_key = key;
+        }
+    }
+
+    // If these final DB batches complete the migration, write the best block
+    // hash marker to the new database and delete from the old one. This signals
+    // that the former is fully caught up to that point in the blockchain and
+    // that all txindex entries have been removed from the latter.
+    if (!interrupted) {
+        batch_olddb.Erase(DB_TXINDEX_BLOCK);
+        batch_newdb.Write(DB_BEST_BLOCK, locator);
+    }
+
+    WriteTxIndexMigrationBatches(*this, block_tree_db,
+                                 batch_newdb, batch_olddb,
+                                 begin_key, key);
+
+    if (interrupted) {
+        LogPrintf("[CANCELLED].\n");
+        return false;
+    }
+
+    uiInterface.ShowProgress("", 100, false);
+
+    LogPrintf("[DONE].\n");
+    return true;
+}
+
+CoinStatsIndexDB::CoinStatsIndexDB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndexDB(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe, GetDBProfile("coinstatsindex"))
+{}
+
+bool CoinStatsIndexDB::ReadStats(const uint256& block_hash, CoinStatsRecord& stats) const
+{
+    return Read(std::make_pair(DB_COINSTATS, block_hash), stats);
+}
+
+bool CoinStatsIndexDB::WriteStats(const uint256& block_hash, const CoinStatsRecord& stats)
+{
+    return Write(std::make_pair(DB_COINSTATS, block_hash), stats);
+}
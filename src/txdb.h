@@ -7,10 +7,14 @@
 #define BITCOIN_TXDB_H
 
 #include <coins.h>
+#include <coinsfilter.h>
 #include <dbwrapper.h>
 #include <chain.h>
 
+#include <atomic>
+#include <future>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -29,15 +33,33 @@ static const int64_t nDefaultDbBatchSize = 16 << 20;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
 static const int64_t nMinDbCache = 4;
-//! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
+//! Max memory allocated to block tree DB specific cache (MiB)
 static const int64_t nMaxBlockDBCache = 2;
-//! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
+//! Max memory allocated to txindex DB specific cache (MiB)
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
-static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to coin stats index DB specific cache (MiB)
+static const int64_t nMaxCoinStatsIndexCache = 8;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
+/**
+ * LevelDB settings for one of the node's databases ("blockindex",
+ * "chainstate", "txindex" or "coinstatsindex"): its defaults with the
+ * -dboption arguments for it applied.
+ */
+DBProfile GetDBProfile(const std::string& name);
+
+/** Check that all -dboption arguments are valid and name a known database. */
+bool CheckDBOptions(std::string& error);
+
+/**
+ * File descriptors that the databases may keep open beyond what they do with
+ * their default settings, as -dboption allows more open files.
+ */
+int GetDBExtraFileDescriptors();
+
 struct CDiskTxPos : public CDiskBlockPos
 {
     unsigned int nTxOffset; // after header
@@ -68,6 +90,10 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Filter over the coins in db, if loaded
+    std::unique_ptr<CoinsFilter> m_filter;
+    //! Whether it was reported that m_filter is over capacity
+    std::atomic<bool> m_filter_full{false};
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -75,12 +101,32 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
+    //! Unlike other views, this leaves mapCoins untouched rather than erasing
+    //! entries as they are written, so that CCoinsViewAsyncFlush can keep
+    //! reading from it meanwhile. The caller releases the map.
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    //! Split the txid space into nParts ranges of equal width and return a
+    //! cursor over the coins in each. All cursors read from one snapshot of
+    //! the database, so they can be iterated concurrently and together cover
+    //! the whole state as of a single best block.
+    std::vector<std::unique_ptr<CCoinsViewCursor>> Cursors(unsigned int nParts) const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
+    //! Build a filter of about nSizeBytes over all coins, which spares lookups
+    //! of missing coins from then on. Returns false if interrupted.
+    bool LoadFilter(size_t nSizeBytes);
     size_t EstimateSize() const override;
+    DBWriteStalls GetWriteStalls() const { return db.GetWriteStalls(); }
+    size_t DynamicMemoryUsage() const { return db.DynamicMemoryUsage(); }
+
+    //! Write coins loaded from a UTXO snapshot of the state at hashBlock. The
+    //! database is marked as being in transition to hashBlock until
+    //! FinishSnapshot is called.
+    bool WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin>>& coins, const uint256& hashBlock);
+    //! Mark the database as consistent with the snapshot at hashBlock.
+    bool FinishSnapshot(const uint256& hashBlock);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -98,13 +144,76 @@ public:
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), fHasEnd(false) {}
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn, const uint256 &hashEndIn):
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), hashEnd(hashEndIn), fHasEnd(true) {}
     std::unique_ptr<CDBIterator> pcursor;
     std::pair<char, COutPoint> keyTmp;
+    //! Txid at which iteration stops, if fHasEnd. Excluded from the range.
+    uint256 hashEnd;
+    bool fHasEnd;
+
+    //! Position the cursor at the first coin with a txid of at least hashBegin.
+    void Seek(const uint256 &hashBegin);
+    //! Cache the key at the current position, or invalidate the cursor.
+    void ReadKey();
 
     friend class CCoinsViewDB;
 };
 
+/**
+ * CCoinsView that writes batches to its backing view from a background thread.
+ *
+ * BatchWrite takes ownership of the dirty entries and returns immediately; the
+ * write to the base view then proceeds in the background while this view keeps
+ * answering reads from the handed-off entries first. At most one write is in
+ * flight: a second BatchWrite waits for the previous one to complete.
+ *
+ * All methods other than the read accessors must be called from a single
+ * thread (the one holding cs_main). Reads may be issued concurrently from
+ * other threads as long as no BatchWrite or Sync call runs at the same time.
+ * Cursor() only reflects completed writes, so callers must Sync() first.
+ */
+class CCoinsViewAsyncFlush final : public CCoinsViewBacked
+{
+private:
+    //! Entries being written to the base view. Not modified while a write is in flight.
+    PooledCoinsMap m_flushing;
+    //! Memory taken by the coins of m_flushing outside of its pool.
+    size_t m_flushing_coins_usage;
+    //! Best block of the write in flight, null if none.
+    uint256 m_flushing_block;
+    std::future<bool> m_write;
+
+    //! Start writing m_flushing to the base view.
+    bool StartWrite(const uint256 &hashBlock);
+    //! Drop the written entries, and give back the memory they took.
+    void ResetFlushing();
+
+public:
+    explicit CCoinsViewAsyncFlush(CCoinsView* view) : CCoinsViewBacked(view), m_flushing_coins_usage(0) {}
+    ~CCoinsViewAsyncFlush();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    //! Takes coins over without copying any entry; unmodified ones are
+    //! skipped by the write but kept until it completes.
+    bool BatchWriteMove(PooledCoinsMap &coins, const uint256 &hashBlock) override;
+
+    //! Memory taken by the entries of the write in flight.
+    size_t DynamicMemoryUsage() const;
+
+    //! Whether a background write has been started and not yet collected by Sync.
+    bool IsWriting() const { return m_write.valid(); }
+
+    //! Collect the result of the write in flight, waiting for it if fWait is
+    //! set. Returns false if the write failed; true otherwise, including when
+    //! the write is still running and fWait is not set.
+    bool Sync(bool fWait = true);
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -119,11 +228,100 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /**
+     * Load the block index entries. They are read from the snapshot at
+     * snapshotPath if one is given and it matches the database, and from the
+     * database otherwise. Either way, they are deserialized and their proof of
+     * work checked on all cores, and reserveBlockIndex is called with their
+     * number before insertBlockIndex is called for each.
+     */
+    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+                            std::function<void(size_t)> reserveBlockIndex, const fs::path& snapshotPath = fs::path());
+    /**
+     * Write the given block index entries, which must match those in the
+     * database, to a flat file at snapshotPath. The database records which
+     * snapshot matches it until the block index is next written.
+     */
+    bool WriteBlockIndexSnapshot(const fs::path& snapshotPath, const std::vector<const CBlockIndex*>& blockinfo);
+};
+
+/**
+ * Base class for the databases of optional indexes (indexes/<name>/)
+ *
+ * The database stores a block locator of the chain the database is synced to
+ * so that the index can efficiently determine the point it last stopped at.
+ * A locator is used instead of a simple hash of the chain tip because blocks
+ * and block index entries may not be flushed to disk until after this database
+ * is updated.
+ */
+class BaseIndexDB : public CDBWrapper
+{
+public:
+    BaseIndexDB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, const DBProfile& profile);
+
+    /// Read block locator of the chain that the index is in sync with.
+    bool ReadBestBlock(CBlockLocator& locator) const;
+
+    /// Write block locator of the chain that the index is in sync with.
+    bool WriteBestBlock(const CBlockLocator& locator);
+};
+
+/** Access to the txindex database (indexes/txindex/) */
+class TxIndexDB : public BaseIndexDB
+{
+public:
+    explicit TxIndexDB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /// Read the disk location of the transaction data with the given hash. Returns false if the
+    /// transaction hash is not indexed.
+    bool ReadTxPos(const uint256& txid, CDiskTxPos& pos) const;
+
+    /// Write a batch of transaction positions to the DB.
+    bool WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos>>& v_pos);
+
+    /// Migrate txindex data from the block tree DB, where it may be for older nodes that have not
+    /// been upgraded yet to the new database.
+    bool MigrateData(CBlockTreeDB& block_tree_db, const CBlockLocator& best_locator);
+};
+
+/** Statistics about the UTXO set as of a block, as kept by the coin stats index */
+struct CoinStatsRecord
+{
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+    /// Hash of the UTXO set, see MuHash3072
+    uint256 hashMuHash;
+    /// Normalized MuHash3072 state, from which the next block's record is computed
+    std::vector<unsigned char> vMuHashState;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nTransactionOutputs));
+        READWRITE(VARINT(nBogoSize));
+        READWRITE(nTotalAmount);
+        READWRITE(hashMuHash);
+        READWRITE(vMuHashState);
+    }
+
+    CoinStatsRecord() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+};
+
+/** Access to the coin stats index database (indexes/coinstats/) */
+class CoinStatsIndexDB : public BaseIndexDB
+{
+public:
+    explicit CoinStatsIndexDB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /// Read the statistics recorded for the block with the given hash.
+    bool ReadStats(const uint256& block_hash, CoinStatsRecord& stats) const;
+
+    /// Write the statistics for the block with the given hash.
+    bool WriteStats(const uint256& block_hash, const CoinStatsRecord& stats);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -314,6 +314,15 @@ int GetNumCores();
 
 void RenameThread(const char* name);
 
+/**
+ * On platforms that support it, tell the kernel the calling thread is
+ * CPU-intensive and non-interactive. See SCHED_BATCH in sched(7) for details.
+ *
+ * @return The return value of pthread_setschedparam(), or 1 on systems
+ * without SCHED_BATCH.
+ */
+int ScheduleBatchPriority();
+
 /**
  * .. and a wrapper that just calls func once
  */
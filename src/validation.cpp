@@ -6,6 +6,7 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilereader.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -14,8 +15,10 @@
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
 #include <cuckoocache.h>
 #include <hash.h>
+#include <index/txindex.h>
 #include <init.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -40,8 +43,14 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
+#include <list>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -154,11 +163,12 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    /** Accept a header whose hash is already known. With fCheckPOW false, its proof of work must have been checked already. */
+    bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CBlockUndo* pblockUndo = nullptr);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
                     CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
 
@@ -173,6 +183,7 @@ public:
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
     bool LoadGenesisBlock(const CChainParams& chainparams);
+    bool ActivateSnapshot(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexSnapshot, unsigned int nChainTx);
 
     void PruneBlockIndexCandidates();
 
@@ -182,7 +193,7 @@ private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
 
-    CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
+    CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash);
     /** Create a new block index entry for a given block hash */
     CBlockIndex * InsertBlockIndex(const uint256& hash);
     void CheckBlockIndex(const Consensus::Params& consensusParams);
@@ -205,9 +216,10 @@ CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nBlockReadAhead = DEFAULT_BLOCK_READAHEAD;
+bool fAsyncFlush = DEFAULT_ASYNC_FLUSH;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
-bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -215,6 +227,7 @@ bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+int nCoinCacheRetain = DEFAULT_DBCACHE_RETAIN;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -277,6 +290,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewAsyncFlush> pcoinsflushing;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
@@ -1012,28 +1026,8 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
             return true;
         }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut->GetHash() != hash)
-                    return error("%s: txid mismatch", __func__);
-                return true;
-            }
-
-            // transaction not found in index, nothing more can be done
-            return false;
+        if (g_txindex) {
+            return g_txindex->FindTx(hash, hashBlock, txOut);
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
@@ -1093,12 +1087,11 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    if (pos.IsNull())
+        return error("ReadBlockFromDisk: No block data at %s", pos.ToString());
 
     // Read block
+    BlockFileStream filein(g_blockfilereader, GetBlockPosFilename(pos, "blk"), pos.nPos, SER_DISK, CLIENT_VERSION);
     try {
         filein >> block;
     }
@@ -1129,6 +1122,115 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+namespace {
+
+/** Blocks recently read by ReadRawBlockFromDisk, most recently used first. */
+class CRawBlockCache
+{
+private:
+    typedef std::list<std::pair<uint256, std::shared_ptr<const std::vector<unsigned char>>>> BlockList;
+
+    CCriticalSection cs;
+    BlockList m_blocks;
+    std::map<uint256, BlockList::iterator> m_block_map;
+    size_t m_size = 0;
+
+public:
+    std::shared_ptr<const std::vector<unsigned char>> Get(const uint256& hash)
+    {
+        LOCK(cs);
+        auto it = m_block_map.find(hash);
+        if (it == m_block_map.end()) {
+            return nullptr;
+        }
+        m_blocks.splice(m_blocks.begin(), m_blocks, it->second);
+        return it->second->second;
+    }
+
+    void Add(const uint256& hash, const std::shared_ptr<const std::vector<unsigned char>>& block)
+    {
+        LOCK(cs);
+        if (block->size() > RAW_BLOCK_CACHE_SIZE || m_block_map.count(hash)) {
+            return;
+        }
+        m_blocks.emplace_front(hash, block);
+        m_block_map.emplace(hash, m_blocks.begin());
+        m_size += block->size();
+        while (m_size > RAW_BLOCK_CACHE_SIZE) {
+            m_size -= m_blocks.back().second->size();
+            m_block_map.erase(m_blocks.back().first);
+            m_blocks.pop_back();
+        }
+    }
+};
+
+CRawBlockCache rawblockcache;
+
+} // namespace
+
+bool ReadRawBlockFromDisk(std::shared_ptr<const std::vector<unsigned char>>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    block = rawblockcache.Get(hash);
+    if (block) {
+        return true;
+    }
+
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetBlockPos();
+    }
+    if (pos.IsNull() || pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int)) {
+        return error("%s: No block data at %s", __func__, pos.ToString());
+    }
+
+    const fs::path path = GetBlockPosFilename(pos, "blk");
+    std::shared_ptr<std::vector<unsigned char>> pblock = std::make_shared<std::vector<unsigned char>>();
+    try {
+        // The block is preceded by the message start and its size.
+        unsigned char header[CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int)];
+        if (g_blockfilereader.Read(path, pos.nPos - sizeof(header), (char*)header, sizeof(header)) != sizeof(header)) {
+            return error("%s: Unexpected end of file at %s", __func__, pos.ToString());
+        }
+        if (memcmp(header, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+            return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+        }
+        const unsigned int nSize = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+        if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE) {
+            return error("%s: Invalid block size %u at %s", __func__, nSize, pos.ToString());
+        }
+        pblock->resize(nSize);
+        if (g_blockfilereader.Read(path, pos.nPos, (char*)pblock->data(), nSize) != nSize) {
+            return error("%s: Unexpected end of file at %s", __func__, pos.ToString());
+        }
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // The hash of the header is cheap to check and catches a stale position.
+    if (Hash(pblock->begin(), pblock->begin() + 80) != hash) {
+        return error("%s: Block hash mismatch for %s at %s", __func__, pindex->ToString(), pos.ToString());
+    }
+
+    rawblockcache.Add(hash, pblock);
+    block = std::move(pblock);
+    return true;
+}
+
+bool RawBlockHasWitness(const std::vector<unsigned char>& block)
+{
+    // A block has witness data only if it has a witness commitment, and then
+    // its coinbase transaction has a witness. So look for the extended
+    // serialization marker (an empty input vector) in the coinbase.
+    size_t nPos = 80;
+    if (nPos >= block.size()) return false;
+    const unsigned char chSize = block[nPos];
+    nPos += chSize < 253 ? 1 : chSize == 253 ? 3 : chSize == 254 ? 5 : 9;
+    nPos += 4; // transaction version
+    return nPos < block.size() && block[nPos] == 0;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1460,23 +1562,17 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashPrevBlock)
 {
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
-        return error("%s: no undo data available", __func__);
-    }
-
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+    if (pos.IsNull())
+        return error("%s: No undo data at %s", __func__, pos.ToString());
 
     // Read block
+    BlockFileStream filein(g_blockfilereader, GetBlockPosFilename(pos, "rev"), pos.nPos, SER_DISK, CLIENT_VERSION);
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<BlockFileStream> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
-        verifier << pindex->pprev->GetBlockHash();
+        verifier << hashPrevBlock;
         verifier >> blockundo;
         filein >> hashChecksum;
     }
@@ -1491,6 +1587,19 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+{
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull()) {
+        return error("%s: no undo data available", __func__);
+    }
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1546,16 +1655,21 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 }
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
+ *  The undo data is read from disk unless pblockUndo provides it, in which case its coins are moved out.
  *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CBlockUndo* pblockUndo)
 {
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    if (!UndoReadFromDisk(blockUndo, pindex)) {
-        error("DisconnectBlock(): failure reading undo data");
-        return DISCONNECT_FAILED;
+    CBlockUndo blockUndoRead;
+    if (!pblockUndo) {
+        if (!UndoReadFromDisk(blockUndoRead, pindex)) {
+            error("DisconnectBlock(): failure reading undo data");
+            return DISCONNECT_FAILED;
+        }
+        pblockUndo = &blockUndoRead;
     }
+    CBlockUndo& blockUndo = *pblockUndo;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
         error("DisconnectBlock(): block and undo data inconsistent");
@@ -1648,31 +1762,54 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
-static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+void ThreadScriptCheck() {
+    RenameThread("bitcoin-scriptch");
+    scriptcheckqueue.Thread();
+}
+
+/**
+ * Closure representing one coin lookup of the prefetch stage in ConnectTip.
+ * The coin is read straight from the coins database into a slot owned by the
+ * caller. It never fails: an outpoint that cannot be read is simply left for
+ * the serial connect logic to fetch (and report) as usual.
+ */
+class CCoinPrefetch
 {
-    if (!fTxIndex) return true;
+private:
+    const CCoinsView* m_view;
+    const COutPoint* m_outpoint;
+    char* m_found;
+
+public:
+    CCoinPrefetch() : m_view(nullptr), m_outpoint(nullptr), m_found(nullptr) {}
+    CCoinPrefetch(const CCoinsView* view, const COutPoint* outpoint, char* found) :
+        m_view(view), m_outpoint(outpoint), m_found(found) {}
 
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
-    for (const CTransactionRef& tx : block.vtx)
+    bool operator()()
     {
-        vPos.push_back(std::make_pair(tx->GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+        try {
+            *m_found = m_view->HaveCoin(*m_outpoint);
+        } catch (const std::runtime_error&) {
+            *m_found = false;
+        }
+        return true;
     }
 
-    if (!pblocktree->WriteTxIndex(vPos)) {
-        return AbortNode(state, "Failed to write transaction index");
+    void swap(CCoinPrefetch& check)
+    {
+        std::swap(m_view, check.m_view);
+        std::swap(m_outpoint, check.m_outpoint);
+        std::swap(m_found, check.m_found);
     }
+};
 
-    return true;
-}
-
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CCoinPrefetch> prefetchqueue(16);
 
-void ThreadScriptCheck() {
-    RenameThread("bitcoin-scriptch");
-    scriptcheckqueue.Thread();
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    prefetchqueue.Thread();
 }
 
 // Protected by cs_main
@@ -1982,9 +2119,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (!WriteTxIndexDataForBlock(block, state, pindex))
-        return false;
-
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -2015,6 +2149,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
     bool fDoFullFlush = false;
     int64_t nNow = 0;
     try {
+    // Release the entries of a finished background coins write.
+    if (!pcoinsflushing->Sync(false))
+        return AbortNode(state, "Failed to write to coin database");
     {
         LOCK(cs_LastBlockFile);
         if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) && !fReindex) {
@@ -2044,7 +2181,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastSetChain = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // Entries still being written in the background count towards the
+        // limit too; flushing again waits for that write to finish.
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pcoinsflushing->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -2081,9 +2220,14 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
+            // Finally remove any pruned files, once an earlier coins write
+            // still in flight is done: were it cut short by a crash, replaying
+            // the blocks it covers needs their undo data.
+            if (fFlushForPrune) {
+                if (!pcoinsflushing->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
                 UnlinkPrunedFiles(setFilesToPrune);
+            }
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2096,8 +2240,37 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // This hands the dirty entries to pcoinsflushing, which writes
+            // them from a background thread while validation continues.
+            // Unless the cache is full and configured not to retain anything,
+            // it stays warm and only unmodified entries are evicted.
+            const bool fCacheFull = fCacheLarge || fCacheCritical;
+            const bool fErase = fCacheFull && nCoinCacheRetain == 0;
+            // Release the previous write before gathering the next one.
+            if (!pcoinsflushing->Sync())
+                return AbortNode(state, "Failed to write to coin database");
+            if (fCacheFull && !fErase) {
+                // Evict unmodified entries first, so that the modified ones,
+                // which are the most recent, are the ones that stay warm.
+                pcoinsTip->Trim(nTotalSpace / 100 * nCoinCacheRetain);
+            }
+            // Modified entries are only kept while they fit in the limit next
+            // to their copies being written; the others are handed over.
+            if (!pcoinsTip->Flush(fErase, std::max<int64_t>(nTotalSpace, 0)))
                 return AbortNode(state, "Failed to write to coin database");
+            if (fCacheFull && !fErase) {
+                // The entries being written still take memory until the write
+                // is done, so the retained ones get what is left of the limit.
+                const int64_t nFlushingUsage = pcoinsflushing->DynamicMemoryUsage();
+                const int64_t nRetainTarget = std::min(nTotalSpace / 100 * nCoinCacheRetain, nTotalSpace - nFlushingUsage);
+                pcoinsTip->Trim(std::max<int64_t>(nRetainTarget, 0));
+            }
+            // Wait for the write when the caller needs the database to be
+            // up to date, or when block files were just pruned.
+            if (!fAsyncFlush || mode == FLUSH_STATE_ALWAYS || fFlushForPrune) {
+                if (!pcoinsflushing->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
+            }
             nLastFlush = nNow;
         }
     }
@@ -2187,6 +2360,237 @@ void static UpdateTip(const CBlockIndex *pindexNew, const CChainParams& chainPar
 
 }
 
+/**
+ * Look up the given coins, which must not be in pcoinsTip, in pcoinsTip
+ * concurrently on the prefetch worker threads, which adds the ones that exist
+ * to it. Returns the number of coins added.
+ */
+static unsigned int FetchCoins(std::vector<COutPoint>& vOutPoints)
+{
+    AssertLockHeld(cs_main);
+
+    // Nothing else touches pcoinsTip or its backing views while the workers
+    // run, so they may look up coins in it concurrently.
+    std::vector<char> vFound(vOutPoints.size());
+    {
+        CCheckQueueControl<CCoinPrefetch> control(&prefetchqueue);
+        std::vector<CCoinPrefetch> vChecks;
+        vChecks.reserve(vOutPoints.size());
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            vChecks.emplace_back(pcoinsTip.get(), &vOutPoints[i], &vFound[i]);
+        }
+        control.Add(vChecks);
+        control.Wait();
+    }
+    return std::count(vFound.begin(), vFound.end(), true);
+}
+
+/**
+ * Warm pcoinsTip with the outputs of a block before it is disconnected, which
+ * DisconnectBlock spends. Like PrefetchBlockInputs, this only affects
+ * performance.
+ */
+static void PrefetchBlockOutputs(const CBlock& block)
+{
+    std::vector<COutPoint> vOutPoints;
+    for (const auto& tx : block.vtx) {
+        for (size_t i = 0; i < tx->vout.size(); i++) {
+            const COutPoint out(tx->GetHash(), i);
+            if (tx->vout[i].scriptPubKey.IsUnspendable() || pcoinsTip->HaveCoinInCache(out)) continue;
+            vOutPoints.push_back(out);
+        }
+    }
+    FetchCoins(vOutPoints);
+}
+
+/**
+ * Persistent threads that read blocks from disk, and check them, ahead of the
+ * validation code that needs them. Tasks run in the order they are queued,
+ * and a discarded result does not wait for its task. While no thread runs,
+ * tasks run on the thread that queues them, so every result gets delivered.
+ */
+class CBlockReaderPool
+{
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()>> m_tasks;
+    std::vector<std::thread> m_threads;
+    //! Whether tasks are queued for the threads rather than run right away. Protected by m_mutex.
+    bool m_running = false;
+
+    void Thread()
+    {
+        RenameThread("bitcoin-blockread");
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cond.wait(lock, [this] { return !m_running || !m_tasks.empty(); });
+            // Tasks still queued when stopping are run first.
+            if (m_tasks.empty()) return;
+            std::function<void()> task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+public:
+    ~CBlockReaderPool() { Stop(); }
+
+    void Start(int nThreads)
+    {
+        Stop();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (int i = 0; i < nThreads; i++) {
+            try {
+                m_threads.emplace_back(&CBlockReaderPool::Thread, this);
+            } catch (const std::system_error& e) {
+                LogPrintf("%s: cannot start block reader thread: %s\n", __func__, e.what());
+                break;
+            }
+        }
+        m_running = !m_threads.empty();
+    }
+
+    void Stop()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_cond.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+        m_threads.clear();
+    }
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> Submit(F func)
+    {
+        typedef typename std::result_of<F()>::type Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(func));
+        std::future<Result> result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_running) {
+                m_tasks.emplace_back([task] { (*task)(); });
+                m_cond.notify_one();
+                return result;
+            }
+        }
+        (*task)();
+        return result;
+    }
+};
+
+static CBlockReaderPool blockreaderpool;
+
+void StartBlockReaderThreads(int nThreads)
+{
+    blockreaderpool.Start(nThreads);
+}
+
+void StopBlockReaderThreads()
+{
+    blockreaderpool.Stop();
+}
+
+/**
+ * Loads and deserializes the blocks and undo data of blocks that are about to
+ * be disconnected, on the block reader threads. Before disconnecting a chain of
+ * blocks, the caller schedules the path from the tip down to the fork point.
+ * Reads are kept in flight for the next nBlockReadAhead blocks of that path,
+ * and DisconnectTip then only has to wait for the ones that aren't ready yet.
+ * Must be used with cs_main held.
+ */
+class CDisconnectReadAhead
+{
+private:
+    struct DisconnectData {
+        std::shared_ptr<CBlock> pblock;
+        CBlockUndo blockundo;
+    };
+
+    //! Blocks left to disconnect, from the tip down, and the next one to start reading
+    std::vector<const CBlockIndex*> m_path;
+    size_t m_next = 0;
+    const Consensus::Params* m_params = nullptr;
+    std::map<uint256, std::future<DisconnectData>> m_pending;
+
+    static DisconnectData Load(CDiskBlockPos blockPos, CDiskBlockPos undoPos, uint256 hash, uint256 hashPrev, const Consensus::Params& params)
+    {
+        DisconnectData data;
+        data.pblock = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*data.pblock, blockPos, params) || data.pblock->GetHash() != hash ||
+            !UndoReadFromDisk(data.blockundo, undoPos, hashPrev)) {
+            // Leave it to DisconnectTip to read the block again and report the failure.
+            data.pblock.reset();
+        }
+        return data;
+    }
+
+    void Fill()
+    {
+        while (m_next < m_path.size() && (int)m_pending.size() < nBlockReadAhead) {
+            const CBlockIndex* pindex = m_path[m_next];
+            if (!pindex->pprev || !(pindex->nStatus & BLOCK_HAVE_DATA) || !(pindex->nStatus & BLOCK_HAVE_UNDO)) break;
+            const CDiskBlockPos blockPos = pindex->GetBlockPos();
+            const CDiskBlockPos undoPos = pindex->GetUndoPos();
+            const uint256 hash = pindex->GetBlockHash();
+            const uint256 hashPrev = pindex->pprev->GetBlockHash();
+            const Consensus::Params& params = *m_params;
+            m_pending.emplace(hash, blockreaderpool.Submit([blockPos, undoPos, hash, hashPrev, &params] {
+                return Load(blockPos, undoPos, hash, hashPrev, params);
+            }));
+            m_next++;
+        }
+    }
+
+public:
+    /** Start reading the blocks from pindexTip down to, but excluding, pindexFork. */
+    void Schedule(const CBlockIndex* pindexTip, const CBlockIndex* pindexFork, const Consensus::Params& params)
+    {
+        AssertLockHeld(cs_main);
+        Clear();
+        for (const CBlockIndex* pindex = pindexTip; pindex && pindex != pindexFork; pindex = pindex->pprev) {
+            m_path.push_back(pindex);
+        }
+        m_params = &params;
+        Fill();
+    }
+
+    /**
+     * Take the block and undo data of the given block, waiting for its read to
+     * complete, and start reading the next block of the path. Returns false if
+     * no read was scheduled for the block or the read failed.
+     */
+    bool Take(const CBlockIndex* pindex, std::shared_ptr<CBlock>& pblock, CBlockUndo& blockundo)
+    {
+        AssertLockHeld(cs_main);
+        auto it = m_pending.find(pindex->GetBlockHash());
+        if (it == m_pending.end()) return false;
+        DisconnectData data = it->second.get();
+        m_pending.erase(it);
+        Fill();
+        if (!data.pblock) return false;
+        pblock = std::move(data.pblock);
+        blockundo = std::move(data.blockundo);
+        return true;
+    }
+
+    void Clear()
+    {
+        // Reads still in flight are dropped without waiting for them.
+        m_pending.clear();
+        m_path.clear();
+        m_next = 0;
+    }
+};
+
+static CDisconnectReadAhead disconnectreadahead;
+
 /** Disconnect chainActive's tip.
   * After calling, the mempool will be in an inconsistent state, with
   * transactions from disconnected blocks being added to disconnectpool.  You
@@ -2201,17 +2605,24 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
-    // Read block from disk.
-    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-    CBlock& block = *pblock;
-    if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
-        return AbortNode(state, "Failed to read block");
+    // Read block from disk, unless it was loaded in the background together
+    // with its undo data.
+    std::shared_ptr<CBlock> pblock;
+    CBlockUndo blockUndo;
+    const bool fHaveUndo = disconnectreadahead.Take(pindexDelete, pblock, blockUndo);
+    if (!fHaveUndo) {
+        pblock = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblock, pindexDelete, chainparams.GetConsensus()))
+            return AbortNode(state, "Failed to read block");
+    }
+    const CBlock& block = *pblock;
+    PrefetchBlockOutputs(block);
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip.get());
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        if (DisconnectBlock(block, pindexDelete, view, fHaveUndo ? &blockUndo : nullptr) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
@@ -2244,11 +2655,103 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
+static int64_t nPrefetchInputs = 0;
+static int64_t nPrefetchCached = 0;
+static int64_t nPrefetchFetched = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+/**
+ * Warm pcoinsTip with the coins spent by a block before it is connected.
+ * Inputs not already in the cache are looked up concurrently on the prefetch
+ * worker threads, so the serial input lookups in ConnectBlock rarely have to
+ * go to disk. Inputs spending outputs created within the same block are
+ * skipped. This only affects performance, never validation results.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vOutPoints;
+    unsigned int nInputs = 0;
+    for (const auto& tx : block.vtx) {
+        if (!tx->IsCoinBase()) {
+            for (const CTxIn& txin : tx->vin) {
+                nInputs++;
+                if (setBlockTxids.count(txin.prevout.hash) || pcoinsTip->HaveCoinInCache(txin.prevout)) continue;
+                vOutPoints.push_back(txin.prevout);
+            }
+        }
+        setBlockTxids.insert(tx->GetHash());
+    }
+
+    const unsigned int nFetched = FetchCoins(vOutPoints);
+
+    int64_t nTimeEnd = GetTimeMicros(); nTimePrefetch += nTimeEnd - nTimeStart;
+    nPrefetchInputs += nInputs;
+    nPrefetchCached += nInputs - vOutPoints.size();
+    nPrefetchFetched += nFetched;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms (%u inputs: %u cached, %u fetched, %u missing) [%.2fs (%.2f%% cached, %.2f%% fetched)]\n",
+        (nTimeEnd - nTimeStart) * MILLI, nInputs, nInputs - vOutPoints.size(), nFetched, vOutPoints.size() - nFetched,
+        nTimePrefetch * MICRO, nPrefetchInputs ? 100.0 * nPrefetchCached / nPrefetchInputs : 0.0,
+        nPrefetchInputs ? 100.0 * nPrefetchFetched / nPrefetchInputs : 0.0);
+}
+
+/** Read a block, and run CheckBlock on it. Returns nullptr if it cannot be read. */
+static std::shared_ptr<const CBlock> LoadBlockAhead(CDiskBlockPos pos, uint256 hash, const Consensus::Params& params)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblock, pos, params) || pblock->GetHash() != hash) {
+        return nullptr;
+    }
+    // A successful check is cached in fChecked, so ConnectBlock can skip
+    // it. Failures are left for ConnectBlock to detect and report.
+    CValidationState state;
+    CheckBlock(*pblock, state, params);
+    return pblock;
+}
+
+void CBlockReadAhead::Schedule(const std::vector<CBlockIndex*>& vpindexToConnect, const CBlockIndex* pindexSkip, const Consensus::Params& params)
+{
+    AssertLockHeld(cs_main);
+    std::map<uint256, BlockFuture> pending;
+    for (const CBlockIndex* pindex : reverse_iterate(vpindexToConnect)) {
+        if ((int)pending.size() >= nBlockReadAhead || !(pindex->nStatus & BLOCK_HAVE_DATA)) break;
+        if (pindex == pindexSkip) continue;
+        const uint256 hash = pindex->GetBlockHash();
+        auto it = m_pending.find(hash);
+        if (it != m_pending.end()) {
+            pending.emplace(hash, std::move(it->second));
+            continue;
+        }
+        const CDiskBlockPos pos = pindex->GetBlockPos();
+        pending.emplace(hash, blockreaderpool.Submit([pos, hash, &params] { return LoadBlockAhead(pos, hash, params); }));
+    }
+    m_pending.swap(pending);
+}
+
+std::shared_ptr<const CBlock> CBlockReadAhead::Take(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    auto it = m_pending.find(hash);
+    if (it == m_pending.end()) return nullptr;
+    std::shared_ptr<const CBlock> pblock = it->second.get();
+    m_pending.erase(it);
+    return pblock;
+}
+
+void CBlockReadAhead::Clear()
+{
+    m_pending.clear();
+}
+
+static CBlockReadAhead blockreadahead;
+
 struct PerBlockConnectTrace {
     CBlockIndex* pindex = nullptr;
     std::shared_ptr<const CBlock> pblock;
@@ -2325,20 +2828,26 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    std::shared_ptr<const CBlock> pthisBlock;
-    if (!pblock) {
+    std::shared_ptr<const CBlock> pthisBlock = pblock;
+    if (!pthisBlock) {
+        // Use the copy loaded in the background, if a read was scheduled.
+        pthisBlock = blockreadahead.Take(pindexNew->GetBlockHash());
+    }
+    if (!pthisBlock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
         pthisBlock = pblockNew;
-    } else {
-        pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    if (nScriptCheckThreads) {
+        PrefetchBlockInputs(blockConnecting);
+        nTime2 = GetTimeMicros();
+    }
     {
         CCoinsViewCache view(pcoinsTip.get());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2458,8 +2967,12 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
     DisconnectedBlockTransactions disconnectpool;
+    if (chainActive.Tip() != pindexFork) {
+        disconnectreadahead.Schedule(chainActive.Tip(), pindexFork, chainparams.GetConsensus());
+    }
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
         if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+            disconnectreadahead.Clear();
             // This is likely a fatal error, but keep the mempool consistent,
             // just in case. Only remove from the mempool in this case.
             UpdateMempoolForReorg(disconnectpool, false);
@@ -2485,6 +2998,9 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
+        // Start loading the blocks we are about to connect in the background.
+        blockreadahead.Schedule(vpindexToConnect, pblock ? pindexMostWork : nullptr, chainparams.GetConsensus());
+
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
@@ -2689,11 +3205,15 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
     CBlockIndex *invalid_walk_tip = chainActive.Tip();
 
     DisconnectedBlockTransactions disconnectpool;
+    if (chainActive.Contains(pindex)) {
+        disconnectreadahead.Schedule(chainActive.Tip(), pindex->pprev, chainparams.GetConsensus());
+    }
     while (chainActive.Contains(pindex)) {
         pindex_was_in_chain = true;
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
         if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+            disconnectreadahead.Clear();
             // It's probably hopeless to try to make the mempool consistent
             // here if DisconnectTip failed, but we can try.
             UpdateMempoolForReorg(disconnectpool, false);
@@ -2775,22 +3295,19 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return g_chainstate.ResetBlockFailureFlags(pindex);
 }
 
-CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = mapBlockIndex.emplace(hash, block).first->second;
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
@@ -2868,7 +3385,12 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
     }
 
     if (!fKnown) {
-        while (vinfoBlockFile[nFile].nSize + nAddSize >= MAX_BLOCKFILE_SIZE) {
+        unsigned int nMaxBlockFileSize = MAX_BLOCKFILE_SIZE;
+        if (gArgs.GetBoolArg("-fastprune", false)) {
+            // Small files for tests, but each still fits the block added to it.
+            nMaxBlockFileSize = std::max(0x10000u, nAddSize + 1);
+        }
+        while (vinfoBlockFile[nFile].nSize + nAddSize >= nMaxBlockFileSize) {
             nFile++;
             if (vinfoBlockFile.size() <= nFile) {
                 vinfoBlockFile.resize(nFile + 1);
@@ -3215,11 +3737,10 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3234,7 +3755,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3264,7 +3785,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         }
     }
     if (pindex == nullptr)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3274,22 +3795,97 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
-// Exposed wrapper for AcceptBlockHeader
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
+/**
+ * Closure representing the context-free checks of one block header: its hash
+ * and its proof of work, written to slots owned by the caller.
+ */
+class CHeaderCheck
 {
-    if (first_invalid != nullptr) first_invalid->SetNull();
+private:
+    const CBlockHeader* m_header;
+    const Consensus::Params* m_params;
+    uint256* m_hash;
+    char* m_valid_pow;
+
+public:
+    CHeaderCheck() : m_header(nullptr), m_params(nullptr), m_hash(nullptr), m_valid_pow(nullptr) {}
+    CHeaderCheck(const CBlockHeader* header, const Consensus::Params* params, uint256* hash, char* valid_pow) :
+        m_header(header), m_params(params), m_hash(hash), m_valid_pow(valid_pow) {}
+
+    bool operator()()
     {
-        LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
-            CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
-                if (first_invalid) *first_invalid = header;
-                return false;
-            }
-            if (ppindex) {
-                *ppindex = pindex;
-            }
-        }
+        *m_hash = m_header->GetHash();
+        *m_valid_pow = CheckProofOfWork(*m_hash, m_header->nBits, *m_params);
+        return true;
+    }
+
+    void swap(CHeaderCheck& check)
+    {
+        std::swap(m_header, check.m_header);
+        std::swap(m_params, check.m_params);
+        std::swap(m_hash, check.m_hash);
+        std::swap(m_valid_pow, check.m_valid_pow);
+    }
+};
+
+/** Headers are only checked on several threads if each gets at least this many. */
+static const unsigned int MIN_HEADERS_PER_CHECK_THREAD = 128;
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(MIN_HEADERS_PER_CHECK_THREAD);
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+HeaderChecks CheckBlockHeaders(const std::vector<CBlockHeader>& headers, const Consensus::Params& params)
+{
+    HeaderChecks checks;
+    checks.hashes.resize(headers.size());
+    checks.valid_pow.resize(headers.size());
+    std::vector<CHeaderCheck> vChecks;
+    vChecks.reserve(headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        vChecks.emplace_back(&headers[i], &params, &checks.hashes[i], &checks.valid_pow[i]);
+    }
+    if (nScriptCheckThreads && headers.size() >= 2 * MIN_HEADERS_PER_CHECK_THREAD) {
+        // The calling thread takes part in the checks while it waits.
+        CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CHeaderCheck& check : vChecks) {
+            check();
+        }
+    }
+    return checks;
+}
+
+// Exposed wrapper for AcceptBlockHeader
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid, const HeaderChecks* checks)
+{
+    if (first_invalid != nullptr) first_invalid->SetNull();
+    // Do the context-free checks before taking cs_main.
+    HeaderChecks local_checks;
+    if (checks == nullptr) {
+        local_checks = CheckBlockHeaders(headers, chainparams.GetConsensus());
+        checks = &local_checks;
+    }
+    assert(checks->hashes.size() == headers.size() && checks->valid_pow.size() == headers.size());
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < headers.size(); i++) {
+            CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
+            // Headers that failed the proof of work check are checked again,
+            // so the failure is reported as it would be for a single header.
+            if (!g_chainstate.AcceptBlockHeader(headers[i], checks->hashes[i], state, chainparams, &pindex, !checks->valid_pow[i])) {
+                if (first_invalid) *first_invalid = headers[i];
+                return false;
+            }
+            if (ppindex) {
+                *ppindex = pindex;
+            }
+        }
     }
     NotifyHeaderTip();
     return true;
@@ -3325,7 +3921,7 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CVali
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, block.GetHash(), state, chainparams, &pindex))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3507,6 +4103,8 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        g_blockfilereader.Close(GetBlockPosFilename(pos, "blk"));
+        g_blockfilereader.Close(GetBlockPosFilename(pos, "rev"));
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3658,22 +4256,15 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
     if (hash.IsNull())
         return nullptr;
 
-    // Return existing
-    BlockMap::iterator mi = mapBlockIndex.find(hash);
-    if (mi != mapBlockIndex.end())
-        return (*mi).second;
-
-    // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
-
-    return pindexNew;
+    // Return existing or create new
+    return mapBlockIndex.emplace(hash).first->second;
 }
 
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); }))
+    const fs::path snapshot_path = gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT) ? GetDataDir() / "blockindex.dat" : fs::path();
+    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); },
+                                      [this](size_t n){ mapBlockIndex.reserve(n); }, snapshot_path))
         return false;
 
     boost::this_thread::interruption_point();
@@ -3681,7 +4272,7 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
     // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (const BlockMap::value_type& item : mapBlockIndex)
     {
         CBlockIndex* pindex = item.second;
         vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
@@ -3748,7 +4339,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     std::set<int> setBlkDataFiles;
-    for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (const BlockMap::value_type& item : mapBlockIndex)
     {
         CBlockIndex* pindex = item.second;
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -3773,10 +4364,6 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
-
     return true;
 }
 
@@ -3913,6 +4500,88 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     return true;
 }
 
+bool VerifyDBBackground(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth)
+{
+    const CBlockIndex* pindex;
+    int nHeightStop;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        if (pindex == nullptr || pindex->pprev == nullptr)
+            return true;
+        if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
+            nCheckDepth = chainActive.Height();
+        nHeightStop = pindex->nHeight - nCheckDepth;
+    }
+    // The coin database checks of levels 3 and 4 need the chain to stay put,
+    // so they are only done at startup.
+    nCheckLevel = std::max(0, std::min(2, nCheckLevel));
+    LogPrintf("Verifying last %i blocks at level %i in the background\n", nCheckDepth, nCheckLevel);
+
+    const int nHeightStart = pindex->nHeight;
+    int reportDone = 0;
+    bool fPruned = false;
+    for (; pindex->pprev && pindex->nHeight > nHeightStop; pindex = pindex->pprev) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return true;
+        int percentageDone = std::max(0, std::min(99, (nHeightStart - pindex->nHeight) * 100 / nCheckDepth));
+        if (reportDone < percentageDone/10) {
+            // report every 10% step
+            LogPrintf("Background block verification: %d%% done\n", percentageDone);
+            reportDone = percentageDone/10;
+        }
+
+        // Only look up where the block is with cs_main held. A block pruned
+        // after that fails to read, and ends the check without an error.
+        CDiskBlockPos blockPos;
+        CDiskBlockPos undoPos;
+        {
+            LOCK(cs_main);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                fPruned = true;
+                break;
+            }
+            blockPos = pindex->GetBlockPos();
+            undoPos = pindex->GetUndoPos();
+        }
+        auto pruned = [pindex] {
+            LOCK(cs_main);
+            return !(pindex->nStatus & BLOCK_HAVE_DATA);
+        };
+
+        CBlock block;
+        CBlockUndo undo;
+        CValidationState state;
+        std::string strError;
+        if (!ReadBlockFromDisk(block, blockPos, chainparams.GetConsensus()) || block.GetHash() != pindex->GetBlockHash()) {
+            // check level 0: read from disk
+            strError = strprintf("ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        } else if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus())) {
+            // check level 1: verify block validity
+            strError = strprintf("found bad block at %d, hash=%s (%s)", pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
+        } else if (nCheckLevel >= 2 && !undoPos.IsNull() && !UndoReadFromDisk(undo, undoPos, pindex->pprev->GetBlockHash())) {
+            // check level 2: verify undo validity
+            strError = strprintf("found bad undo data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+        if (!strError.empty()) {
+            if (pruned()) {
+                fPruned = true;
+                break;
+            }
+            return AbortNode("VerifyDB(): *** " + strError, _("Corrupted block database detected. Please restart with -reindex to recover."));
+        }
+    }
+
+    if (fPruned) {
+        LogPrintf("Background block verification stopped at height %d (pruning, no data), no errors found in the %d blocks %d to %d\n",
+            pindex->nHeight, nHeightStart - pindex->nHeight, pindex->nHeight + 1, nHeightStart);
+    } else {
+        LogPrintf("Background block verification done, no errors found in blocks %d to %d\n", pindex->nHeight + 1, nHeightStart);
+    }
+    return true;
+}
+
 /** Apply the effects of a block on the utxo cache, ignoring that it may already have been applied. */
 bool CChainState::RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs, const CChainParams& params)
 {
@@ -4108,6 +4777,8 @@ bool RewindBlockIndex(const CChainParams& params) {
 }
 
 void CChainState::UnloadBlockIndex() {
+    blockreadahead.Clear();
+    disconnectreadahead.Clear();
     nBlockSequenceId = 1;
     g_failed_blocks.clear();
     setBlockIndexCandidates.clear();
@@ -4133,9 +4804,6 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
     fHavePruned = false;
 
@@ -4160,9 +4828,6 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         // needs_init.
 
         LogPrintf("Initializing databases...\n");
-        // Use the provided setting for -txindex in the new database
-        fTxIndex = gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX);
-        pblocktree->WriteFlag("txindex", fTxIndex);
     }
     return true;
 }
@@ -4183,7 +4848,7 @@ bool CChainState::LoadGenesisBlock(const CChainParams& chainparams)
         CDiskBlockPos blockPos = SaveBlockToDisk(block, 0, chainparams, nullptr);
         if (blockPos.IsNull())
             return error("%s: writing genesis block to disk failed", __func__);
-        CBlockIndex *pindex = AddToBlockIndex(block);
+        CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
         CValidationState state;
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos, chainparams.GetConsensus()))
             return error("%s: genesis block not accepted", __func__);
@@ -4199,6 +4864,97 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
+/** Number of bytes of blocks LoadExternalBlockFile reads before handing them to the checking threads. */
+static const size_t LOAD_BLOCK_BATCH_SIZE = 2 * MAX_BLOCK_SERIALIZED_SIZE;
+
+namespace {
+
+/** Size of the message start and size in front of every block in a block file. */
+static const size_t BLOCK_RECORD_HEADER_SIZE = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+/** A block record read from a block file by LoadExternalBlockFile. */
+struct ExternalBlockRecord
+{
+    //! Position of the serialized block in the file
+    uint64_t nBlockPos;
+    //! The record as read from the file: message start, size and serialized
+    //! block. Freed once the block turns out to take up the whole record.
+    std::vector<char> vData;
+    //! The deserialized block, or nullptr if deserialization failed
+    std::shared_ptr<CBlock> pblock;
+    uint256 hash;
+    //! Number of bytes of the record the serialized block took up
+    size_t nBlockSize = 0;
+    std::string strError;
+
+    explicit ExternalBlockRecord(uint64_t nBlockPosIn) : nBlockPos(nBlockPosIn) {}
+};
+
+/**
+ * A batch of block records read from a block file, and the deserialization
+ * and context-free checks running on them on the block reader threads.
+ */
+struct ExternalBlockBatch
+{
+    std::vector<ExternalBlockRecord> records;
+    //! Index of the next record to check
+    std::atomic<size_t> nNextCheck{0};
+    std::vector<std::future<void>> checks;
+
+    ExternalBlockBatch() = default;
+    ExternalBlockBatch(const ExternalBlockBatch&) = delete;
+    ExternalBlockBatch& operator=(const ExternalBlockBatch&) = delete;
+    //! The checks use the records, so they are waited for first.
+    ~ExternalBlockBatch() { Wait(); }
+
+    void Wait()
+    {
+        for (std::future<void>& check : checks) {
+            if (check.valid()) check.wait();
+        }
+    }
+};
+
+/** Deserialize and hash the block of a record, and run CheckBlock on it. Needs no lock. */
+void CheckExternalBlock(ExternalBlockRecord& record, const Consensus::Params& params)
+{
+    try {
+        CDataStream stream(record.vData.data() + BLOCK_RECORD_HEADER_SIZE, record.vData.data() + record.vData.size(), SER_DISK, CLIENT_VERSION);
+        const size_t nSize = stream.size();
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        stream >> *pblock;
+        record.nBlockSize = nSize - stream.size();
+        record.hash = pblock->GetHash();
+        // A successful check is cached in fChecked, so AcceptBlock can skip
+        // it. Failures are left for AcceptBlock to detect and report.
+        CValidationState state;
+        CheckBlock(*pblock, state, params);
+        record.pblock = std::move(pblock);
+        if (record.nBlockSize == nSize) {
+            std::vector<char>().swap(record.vData);
+        }
+    } catch (const std::exception& e) {
+        record.strError = e.what();
+    }
+}
+
+/** Start checking the records of a batch on the block reader threads. */
+void StartExternalBlockChecks(ExternalBlockBatch& batch, const Consensus::Params& params)
+{
+    // Blocks differ a lot in size, so each task takes them one at a time.
+    ExternalBlockBatch* pbatch = &batch;
+    const size_t nTasks = std::min<size_t>(std::max(1, GetNumCores()), batch.records.size());
+    for (size_t i = 0; i < nTasks; i++) {
+        batch.checks.push_back(blockreaderpool.Submit([pbatch, &params] {
+            for (size_t n = pbatch->nNextCheck++; n < pbatch->records.size(); n = pbatch->nNextCheck++) {
+                CheckExternalBlock(pbatch->records[n], params);
+            }
+        }));
+    }
+}
+
+} // namespace
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4206,111 +4962,224 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+    // Process a block in file order. Returns false if loading must stop.
+    auto process_block = [&](const ExternalBlockRecord& record) {
+        if (dbp)
+            dbp->nPos = record.nBlockPos;
+        const std::shared_ptr<CBlock>& pblock = record.pblock;
+        const CBlock& block = *pblock;
+        const uint256& hash = record.hash;
+
+        // detect out of order blocks, and store them for later
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+            LogPrint(BCLog::REINDEX, "LoadExternalBlockFile: Out of order block %s, parent %s not known\n", hash.ToString(),
+                    block.hashPrevBlock.ToString());
+            if (dbp)
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+            LOCK(cs_main);
+            CValidationState state;
+            if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
+                nLoaded++;
+            if (state.IsError())
+                return false;
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+            LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+        }
+
+        // Activate the genesis block so normal node progress can continue
+        if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+            CValidationState state;
+            if (!ActivateBestChain(state, chainparams)) {
+                return false;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+        }
+
+        NotifyHeaderTip();
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        // Recursively process earlier encountered successors of this block
+        std::deque<uint256> queue;
+        queue.push_back(hash);
+        while (!queue.empty()) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+            while (range.first != range.second) {
+                std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+                if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+                {
+                    LogPrint(BCLog::REINDEX, "LoadExternalBlockFile: Processing out of order child %s of %s\n", pblockrecursive->GetHash().ToString(),
+                            head.ToString());
                     LOCK(cs_main);
-                    CValidationState state;
-                    if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
+                    CValidationState dummy;
+                    if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                    {
                         nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                        queue.push_back(pblockrecursive->GetHash());
+                    }
                 }
+                range.first++;
+                mapBlocksUnknownParent.erase(it);
+                NotifyHeaderTip();
+            }
+        }
+        return true;
+    };
+
+    // The reader trusts the size of a record to find the next one. When a
+    // record does not hold a block, or holds a shorter one, the blocks inside
+    // the rest of it are looked for and processed here, exactly as if the
+    // file was scanned one record at a time. Returns false if loading must
+    // stop. If a record inside runs past the end of the outer one, scanning
+    // has to start over from the file at nRescanPos.
+    auto process_rest_of_record = [&](const ExternalBlockRecord& record, size_t nOffset, bool& fRescan, uint64_t& nRescanPos) {
+        const std::vector<char>& vData = record.vData;
+        const uint64_t nRecordPos = record.nBlockPos - BLOCK_RECORD_HEADER_SIZE;
+        while (true) {
+            boost::this_thread::interruption_point();
+            // locate a header
+            auto it = std::find(vData.begin() + nOffset, vData.end(), (char)chainparams.MessageStart()[0]);
+            if (it == vData.end()) {
+                return true;
+            }
+            const size_t nHeaderOffset = it - vData.begin();
+            if (nHeaderOffset + BLOCK_RECORD_HEADER_SIZE > vData.size()) {
+                fRescan = true;
+                nRescanPos = nRecordPos + nHeaderOffset;
+                return true;
+            }
+            nOffset = nHeaderOffset + 1;
+            if (memcmp(&vData[nHeaderOffset], chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            unsigned int nSize = ReadLE32((const unsigned char*)&vData[nHeaderOffset + CMessageHeader::MESSAGE_START_SIZE]);
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+            if (nHeaderOffset + BLOCK_RECORD_HEADER_SIZE + nSize > vData.size()) {
+                fRescan = true;
+                nRescanPos = nRecordPos + nHeaderOffset;
+                return true;
+            }
+            // read block
+            ExternalBlockRecord inner(nRecordPos + nHeaderOffset + BLOCK_RECORD_HEADER_SIZE);
+            inner.vData.assign(it, it + BLOCK_RECORD_HEADER_SIZE + nSize);
+            CheckExternalBlock(inner, chainparams.GetConsensus());
+            if (!inner.pblock) {
+                LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", inner.strError);
+                continue;
+            }
+            if (!process_block(inner)) {
+                return false;
+            }
+            nOffset = nHeaderOffset + BLOCK_RECORD_HEADER_SIZE + inner.nBlockSize;
+        }
+    };
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
+    // Blocks are read in batches. While a batch is deserialized and checked on
+    // the block reader threads, the previous one is processed in file order.
+    std::deque<ExternalBlockBatch> batches;
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        bool fEnd = false;
+        while (!fEnd || !batches.empty()) {
+            if (!fEnd) {
+                batches.emplace_back();
+                ExternalBlockBatch& batch = batches.back();
+                size_t nBatchSize = 0;
+                while (nBatchSize < LOAD_BLOCK_BATCH_SIZE) {
+                    boost::this_thread::interruption_point();
+                    if (blkdat.eof()) {
+                        fEnd = true;
                         break;
                     }
-                }
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
+                    blkdat.SetPos(nRewind);
+                    nRewind++; // start one byte further next time, in case of failure
+                    blkdat.SetLimit(); // remove former limit
+                    unsigned int nSize = 0;
+                    try {
+                        // locate a header
+                        unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                        blkdat.FindByte(chainparams.MessageStart()[0]);
+                        nRewind = blkdat.GetPos()+1;
+                        blkdat >> FLATDATA(buf);
+                        if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                            continue;
+                        // read size
+                        blkdat >> nSize;
+                        if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                            continue;
+                    } catch (const std::exception&) {
+                        // no valid block header found; don't complain
+                        fEnd = true;
+                        break;
+                    }
+                    try {
+                        // read block
+                        uint64_t nBlockPos = blkdat.GetPos();
+                        blkdat.SetLimit(nBlockPos + nSize);
+                        ExternalBlockRecord record(nBlockPos);
+                        record.vData.resize(BLOCK_RECORD_HEADER_SIZE + nSize);
+                        memcpy(record.vData.data(), chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE);
+                        WriteLE32((unsigned char*)&record.vData[CMessageHeader::MESSAGE_START_SIZE], nSize);
+                        blkdat.read(&record.vData[BLOCK_RECORD_HEADER_SIZE], nSize);
+                        nRewind = blkdat.GetPos();
+                        batch.records.push_back(std::move(record));
+                        nBatchSize += nSize;
+                    } catch (const std::exception& e) {
+                        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                StartExternalBlockChecks(batch, chainparams.GetConsensus());
+                if (!fEnd && batches.size() < 2) continue;
+            }
+
+            // Process the oldest batch.
+            ExternalBlockBatch& batch = batches.front();
+            batch.Wait();
+            bool fStop = false;
+            bool fRescan = false;
+            uint64_t nRescanPos = 0;
+            for (const ExternalBlockRecord& record : batch.records) {
+                boost::this_thread::interruption_point();
+                if (!record.pblock) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, record.strError);
+                    // Look for a block from just after the message start on.
+                    fStop = !process_rest_of_record(record, 1, fRescan, nRescanPos);
+                } else if (!process_block(record)) {
+                    fStop = true;
+                } else if (!record.vData.empty()) {
+                    fStop = !process_rest_of_record(record, BLOCK_RECORD_HEADER_SIZE + record.nBlockSize, fRescan, nRescanPos);
+                }
+                if (fStop || fRescan) break;
+            }
+            batches.pop_front();
+            if (fStop) {
+                break;
+            }
+            if (fRescan) {
+                batches.clear();
+                if (!blkdat.Seek(nRescanPos)) {
+                    LogPrintf("%s: cannot rewind to position %u\n", __func__, nRescanPos);
+                    break;
+                }
+                nRewind = nRescanPos;
+                fEnd = false;
             }
         }
     } catch (const std::runtime_error& e) {
+        batches.clear();
         AbortNode(std::string("System error: ") + e.what());
     }
+    batches.clear();
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
@@ -4334,7 +5203,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
-    for (auto& entry : mapBlockIndex) {
+    for (const auto& entry : mapBlockIndex) {
         forward.insert(std::make_pair(entry.second->pprev, entry.second));
     }
 
@@ -4657,6 +5526,366 @@ bool DumpMempool(void)
     return true;
 }
 
+bool DumpBlockIndexSnapshot()
+{
+    int64_t start = GetTimeMicros();
+
+    LOCK(cs_main);
+    // The snapshot must match the block index database.
+    if (!setDirtyBlockIndex.empty()) {
+        LogPrintf("Failed to dump block index: block index not flushed\n");
+        return false;
+    }
+    std::vector<const CBlockIndex*> vBlocks;
+    vBlocks.reserve(mapBlockIndex.size());
+    for (const BlockMap::value_type& item : mapBlockIndex) {
+        vBlocks.push_back(item.second);
+    }
+    if (!pblocktree->WriteBlockIndexSnapshot(GetDataDir() / "blockindex.dat", vBlocks)) {
+        LogPrintf("Failed to dump block index. Continuing anyway.\n");
+        return false;
+    }
+    LogPrintf("Dumped block index: %u entries in %gs\n", vBlocks.size(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+static const uint32_t UTXO_SNAPSHOT_VERSION = 1;
+/** Size above which the chunk being built is written out when dumping a UTXO snapshot */
+static const size_t UTXO_SNAPSHOT_CHUNK_SIZE = 4 << 20;
+/** Largest UTXO snapshot chunk accepted when loading */
+static const uint64_t MAX_UTXO_SNAPSHOT_CHUNK_SIZE = 64 << 20;
+
+/**
+ * Header of a UTXO snapshot file. It is followed by a sequence of chunks, each
+ * a compact size length and that many bytes, terminated by an empty chunk. A
+ * chunk holds whole transactions in database order: the txid, VARINT(number
+ * of outputs), then VARINT(index) and the Coin for each output. The file ends
+ * with the number of coins and a hash of the header, the chunk contents and
+ * that number.
+ */
+struct UTXOSnapshotHeader
+{
+    char pchMessageStart[CMessageHeader::MESSAGE_START_SIZE];
+    uint32_t nVersion;
+    //! Block the snapshot was taken at, and its cumulative transaction count
+    uint256 hashBlock;
+    unsigned int nChainTx;
+    //! Headers from height 1 up to and including hashBlock
+    std::vector<CBlockHeader> vHeaders;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nChainTx);
+        READWRITE(vHeaders);
+    }
+};
+
+static void WriteSnapshotTx(CDataStream& chunk, const uint256& txid, const std::map<uint32_t, Coin>& outputs)
+{
+    chunk << txid;
+    chunk << VARINT((uint32_t)outputs.size());
+    for (const auto& output : outputs) {
+        chunk << VARINT(output.first);
+        chunk << output.second;
+    }
+}
+
+static void WriteSnapshotChunk(CAutoFile& file, CHashWriter& hasher, CDataStream& chunk)
+{
+    WriteCompactSize(file, chunk.size());
+    file.write(chunk.data(), chunk.size());
+    hasher.write(chunk.data(), chunk.size());
+    chunk.clear();
+}
+
+static std::vector<std::pair<COutPoint, Coin>> ReadSnapshotChunk(CDataStream chunk)
+{
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    while (!chunk.empty()) {
+        uint256 txid;
+        uint32_t nOutputs;
+        chunk >> txid;
+        chunk >> VARINT(nOutputs);
+        if (nOutputs == 0) {
+            throw std::ios_base::failure("transaction without outputs");
+        }
+        while (nOutputs--) {
+            uint32_t n;
+            Coin coin;
+            chunk >> VARINT(n);
+            chunk >> coin;
+            if (coin.IsSpent()) {
+                throw std::ios_base::failure("spent coin");
+            }
+            coins.emplace_back(COutPoint(txid, n), std::move(coin));
+        }
+    }
+    return coins;
+}
+
+bool DumpUTXOSnapshot(const fs::path& path, CValidationState& state, uint256& hashBlockRet, uint64_t& nCoinsRet)
+{
+    int64_t nStart = GetTimeMicros();
+
+    UTXOSnapshotHeader header;
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        // The cursor reads from a consistent database snapshot, so the lock
+        // is not needed while iterating.
+        pcursor.reset(pcoinsdbview->Cursor());
+        const CBlockIndex* pindex = mapBlockIndex.find(pcursor->GetBestBlock())->second;
+        memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+        header.nVersion = UTXO_SNAPSHOT_VERSION;
+        header.hashBlock = pindex->GetBlockHash();
+        header.nChainTx = pindex->nChainTx;
+        header.vHeaders.resize(pindex->nHeight);
+        for (; pindex->pprev; pindex = pindex->pprev) {
+            header.vHeaders[pindex->nHeight - 1] = pindex->GetBlockHeader();
+        }
+    }
+
+    const fs::path pathTmp = path.string() + ".incomplete";
+    uint64_t nCoins = 0;
+    try {
+        FILE* filestr = fsbridge::fopen(pathTmp, "wb");
+        if (!filestr) {
+            return state.Error(strprintf("Unable to open %s for writing", pathTmp.string()));
+        }
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        file << header;
+        hasher << header;
+
+        CDataStream chunk(SER_DISK, CLIENT_VERSION);
+        uint256 prevkey;
+        std::map<uint32_t, Coin> outputs;
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                return state.Error("Unable to read UTXO set");
+            }
+            if (!outputs.empty() && key.hash != prevkey) {
+                WriteSnapshotTx(chunk, prevkey, outputs);
+                outputs.clear();
+                if (chunk.size() >= UTXO_SNAPSHOT_CHUNK_SIZE) {
+                    WriteSnapshotChunk(file, hasher, chunk);
+                }
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+            nCoins++;
+            pcursor->Next();
+        }
+        if (!outputs.empty()) {
+            WriteSnapshotTx(chunk, prevkey, outputs);
+        }
+        if (!chunk.empty()) {
+            WriteSnapshotChunk(file, hasher, chunk);
+        }
+        WriteCompactSize(file, 0);
+        hasher << nCoins;
+        file << nCoins;
+        file << hasher.GetHash();
+
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, path)) {
+            return state.Error(strprintf("Unable to rename %s to %s", pathTmp.string(), path.string()));
+        }
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Failed to write UTXO snapshot: %s", e.what()));
+    }
+
+    LogPrintf("Dumped %u coins at block %s to %s in %.2fs\n", nCoins, header.hashBlock.ToString(), path.string(), (GetTimeMicros() - nStart) * MICRO);
+    hashBlockRet = header.hashBlock;
+    nCoinsRet = nCoins;
+    return true;
+}
+
+bool CChainState::ActivateSnapshot(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexSnapshot, unsigned int nChainTx)
+{
+    AssertLockHeld(cs_main);
+
+    // The blocks below the snapshot were never downloaded, and are accounted
+    // for like pruned ones. Only the cumulative transaction count of the
+    // snapshot block is known: every other block without data counts as one
+    // transaction, and the snapshot block makes up the difference.
+    std::vector<CBlockIndex*> vChain(pindexSnapshot->nHeight);
+    for (CBlockIndex* pindex = pindexSnapshot; pindex->pprev; pindex = pindex->pprev) {
+        vChain[pindex->nHeight - 1] = pindex;
+    }
+    std::vector<const CBlockIndex*> vBlocks;
+    for (CBlockIndex* pindex : vChain) {
+        if (pindex->nTx == 0) {
+            pindex->nTx = 1;
+            if (pindex == pindexSnapshot && nChainTx > pindex->pprev->nChainTx) {
+                pindex->nTx = nChainTx - pindex->pprev->nChainTx;
+            }
+        }
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        vBlocks.push_back(pindex);
+    }
+
+    // Write the block index before the coins database refers to the snapshot
+    // block, so that the chain is linked up to it on restart.
+    {
+        LOCK(cs_LastBlockFile);
+        if (!pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*>>(), nLastBlockFile, vBlocks) ||
+            !pblocktree->WriteFlag("prunedblockfiles", true)) {
+            return AbortNode(state, "Failed to write to block index database");
+        }
+        fHavePruned = true;
+    }
+    if (!pcoinsdbview->FinishSnapshot(pindexSnapshot->GetBlockHash())) {
+        return AbortNode(state, "Failed to write to coin database");
+    }
+    pcoinsTip.reset(new CCoinsViewCache(pcoinsflushing.get(), COINS_TIP_SHARDS));
+    pcoinsTip->SetBestBlock(pindexSnapshot->GetBlockHash());
+    chainActive.SetTip(pindexSnapshot);
+    setBlockIndexCandidates.insert(pindexSnapshot);
+
+    // Blocks already received on top of the chain can now be linked to it.
+    std::deque<CBlockIndex*> queue;
+    for (CBlockIndex* pindex = pindexSnapshot; pindex; pindex = pindex->pprev) {
+        auto range = mapBlocksUnlinked.equal_range(pindex);
+        for (auto it = range.first; it != range.second; ++it) {
+            queue.push_back(it->second);
+        }
+        mapBlocksUnlinked.erase(range.first, range.second);
+    }
+    while (!queue.empty()) {
+        CBlockIndex* pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        if (!setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        auto range = mapBlocksUnlinked.equal_range(pindex);
+        for (auto it = range.first; it != range.second; ++it) {
+            queue.push_back(it->second);
+        }
+        mapBlocksUnlinked.erase(range.first, range.second);
+    }
+
+    PruneBlockIndexCandidates();
+    UpdateTip(pindexSnapshot, chainparams);
+    CheckBlockIndex(chainparams.GetConsensus());
+    return true;
+}
+
+bool LoadUTXOSnapshot(const fs::path& path, CValidationState& state, const CChainParams& chainparams, uint256& hashBlockRet, uint64_t& nCoinsRet)
+{
+    int64_t nStart = GetTimeMicros();
+
+    if (!fPruneMode) {
+        return state.Error("Loading a UTXO snapshot requires pruning to be enabled (-prune)");
+    }
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return state.Error(strprintf("Unable to open %s", path.string()));
+    }
+    UTXOSnapshotHeader header;
+    try {
+        file >> header;
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Invalid UTXO snapshot header: %s", e.what()));
+    }
+    if (memcmp(header.pchMessageStart, chainparams.MessageStart(), sizeof(header.pchMessageStart)) != 0) {
+        return state.Error("UTXO snapshot is for a different network");
+    }
+    if (header.nVersion != UTXO_SNAPSHOT_VERSION) {
+        return state.Error(strprintf("Unsupported UTXO snapshot version %u", header.nVersion));
+    }
+    if (header.vHeaders.empty() || header.vHeaders.back().GetHash() != header.hashBlock) {
+        return state.Error("UTXO snapshot headers do not lead to its block");
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Height() != 0) {
+        return state.Error("A UTXO snapshot can only be loaded into an empty chainstate");
+    }
+    if (!ProcessNewBlockHeaders(header.vHeaders, state, chainparams)) {
+        return false;
+    }
+    CBlockIndex* pindexSnapshot = mapBlockIndex.find(header.hashBlock)->second;
+    if (pindexSnapshot->nHeight != (int)header.vHeaders.size()) {
+        return state.Error("UTXO snapshot headers do not start at the genesis block");
+    }
+    // Make the headers durable before the coins database refers to them.
+    FlushStateToDisk();
+
+    // Chunks are deserialized in parallel, and written to the database in
+    // file order, which is also key order.
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    hasher << header;
+    const size_t nMaxPending = std::max(1, GetNumCores());
+    uint64_t nCoins = 0;
+    try {
+        std::deque<std::future<std::vector<std::pair<COutPoint, Coin>>>> pending;
+        bool fEnd = false;
+        while (!fEnd || !pending.empty()) {
+            if (!fEnd && pending.size() < nMaxPending) {
+                uint64_t nSize = ReadCompactSize(file);
+                if (nSize == 0) {
+                    fEnd = true;
+                    continue;
+                }
+                if (nSize > MAX_UTXO_SNAPSHOT_CHUNK_SIZE) {
+                    throw std::ios_base::failure("oversized chunk");
+                }
+                CDataStream chunk(SER_DISK, CLIENT_VERSION);
+                chunk.resize(nSize);
+                file.read(chunk.data(), nSize);
+                hasher.write(chunk.data(), nSize);
+                pending.push_back(std::async(std::launch::async, ReadSnapshotChunk, std::move(chunk)));
+                continue;
+            }
+            std::vector<std::pair<COutPoint, Coin>> coins = pending.front().get();
+            pending.pop_front();
+            if (!pcoinsdbview->WriteSnapshotCoins(coins, header.hashBlock)) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+            nCoins += coins.size();
+        }
+        uint64_t nCoinsExpected;
+        uint256 hashExpected;
+        file >> nCoinsExpected;
+        file >> hashExpected;
+        hasher << nCoins;
+        if (nCoins != nCoinsExpected || hasher.GetHash() != hashExpected) {
+            throw std::ios_base::failure("hash mismatch");
+        }
+    } catch (const std::exception& e) {
+        // Coins may already have been written: leave the database marked as
+        // inconsistent and shut down.
+        return AbortNode(state, strprintf("Failed to load UTXO snapshot: %s", e.what()),
+                         _("Loading the UTXO snapshot failed. Restart with -reindex-chainstate to rebuild the chainstate."));
+    }
+
+    if (!g_chainstate.ActivateSnapshot(state, chainparams, pindexSnapshot, header.nChainTx)) {
+        return false;
+    }
+
+    LogPrintf("Loaded %u coins at block %s from %s in %.2fs\n", nCoins, header.hashBlock.ToString(), path.string(), (GetTimeMicros() - nStart) * MICRO);
+    hashBlockRet = header.hashBlock;
+    nCoinsRet = nCoins;
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
     if (pindex == nullptr)
@@ -4675,15 +5904,3 @@ double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pin
     return pindex->nChainTx / fTxTotal;
 }
 
-class CMainCleanup
-{
-public:
-    CMainCleanup() {}
-    ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
-        mapBlockIndex.clear();
-    }
-} instance_of_cmaincleanup;
@@ -11,6 +11,7 @@
 #endif
 
 #include <amount.h>
+#include <blockmap.h>
 #include <coins.h>
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
@@ -21,7 +22,9 @@
 
 #include <algorithm>
 #include <exception>
+#include <future>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -32,7 +35,9 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
+class CCoinsViewAsyncFlush;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
@@ -80,6 +85,16 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of blocks read ahead of block connection or disconnection */
+static const int MAX_BLOCK_READAHEAD = 64;
+/** -blockreadahead default (number of blocks read ahead of block connection or disconnection, 0 = disabled) */
+static const int DEFAULT_BLOCK_READAHEAD = 8;
+/** -asyncflush default (write the coins cache to disk from a background thread) */
+static const bool DEFAULT_ASYNC_FLUSH = true;
+/** -dbcacheretain default (percentage of the coins cache kept in memory after a size-triggered flush, 0 = drop the whole cache) */
+static const int DEFAULT_DBCACHE_RETAIN = 50;
+/** Number of shards of the coins cache of the chain tip, which the prefetch threads look up coins in concurrently */
+static const size_t COINS_TIP_SHARDS = 16;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -130,9 +145,12 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_COINSTATSINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = false;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -149,16 +167,10 @@ static const bool DEFAULT_PEERBLOOMFILTERS = true;
 /** Default for -stopatheight */
 static const int DEFAULT_STOPATHEIGHT = 0;
 
-struct BlockHasher
-{
-    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
-};
-
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
-typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap& mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockWeight;
@@ -168,12 +180,14 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
+extern int nBlockReadAhead;
+extern bool fAsyncFlush;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+extern int nCoinCacheRetain;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -208,6 +222,10 @@ static const unsigned int NODE_NETWORK_LIMITED_MIN_BLOCKS = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** -checkblocksbackground default (only check the tip at startup, and the rest of -checkblocks in the background) */
+static const bool DEFAULT_CHECKBLOCKS_BACKGROUND = true;
+/** Number of blocks checked at startup when the rest is checked in the background */
+static const signed int STARTUP_CHECKBLOCKS = 1;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -240,6 +258,21 @@ static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
  */
 bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool* fNewBlock);
 
+/** The results of the context-free checks of a batch of block headers. */
+struct HeaderChecks
+{
+    //! The hash of each header
+    std::vector<uint256> hashes;
+    //! Whether each header has valid proof of work (char rather than bool, so threads can set them concurrently)
+    std::vector<char> valid_pow;
+};
+
+/**
+ * Hash a batch of block headers and check their proof of work. Large batches
+ * are shared with the header checking threads. Needs no lock.
+ */
+HeaderChecks CheckBlockHeaders(const std::vector<CBlockHeader>& headers, const Consensus::Params& params);
+
 /**
  * Process incoming block headers.
  *
@@ -250,8 +283,9 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  * @param[in]  chainparams The params for the chain we want to connect to
  * @param[out] ppindex If set, the pointer will be set to point to the last new block index object for the given headers
  * @param[out] first_invalid First header that fails validation, if one exists
+ * @param[in]  checks The result of CheckBlockHeaders for the headers, if the caller already has it
  */
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr, const HeaderChecks* checks=nullptr);
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
@@ -272,6 +306,47 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch();
+/** Run an instance of the block header checking thread */
+void ThreadHeaderCheck();
+/** Start the threads that read blocks ahead of validation. */
+void StartBlockReaderThreads(int nThreads);
+/** Stop the block reader threads, once the reads already queued are done. */
+void StopBlockReaderThreads();
+
+/**
+ * Loads, deserializes and runs CheckBlock on blocks that are about to be
+ * connected, on the block reader threads. ActivateBestChainStep schedules the
+ * next nBlockReadAhead blocks on the path towards the most-work chain, and
+ * ConnectTip then only has to wait for blocks that aren't ready yet.
+ * Must be used with cs_main held.
+ */
+class CBlockReadAhead
+{
+private:
+    typedef std::future<std::shared_ptr<const CBlock>> BlockFuture;
+    std::map<uint256, BlockFuture> m_pending;
+
+public:
+    /**
+     * Make sure reads are in flight for the first nBlockReadAhead blocks of
+     * vpindexToConnect (ordered from the highest to the lowest block, as
+     * built by ActivateBestChainStep), except pindexSkip. Reads for blocks
+     * not in that window are dropped without waiting for them.
+     */
+    void Schedule(const std::vector<CBlockIndex*>& vpindexToConnect, const CBlockIndex* pindexSkip, const Consensus::Params& params);
+
+    /**
+     * Return the block with the given hash if a read was scheduled for it,
+     * waiting for the read to complete. Returns nullptr if no read was
+     * scheduled or the read failed.
+     */
+    std::shared_ptr<const CBlock> Take(const uint256& hash);
+
+    /** Drop all reads, without waiting for them. */
+    void Clear();
+};
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -396,6 +471,19 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
+
+/** Size of the cache of blocks read by ReadRawBlockFromDisk, in bytes. */
+static const size_t RAW_BLOCK_CACHE_SIZE = 16 << 20;
+
+/**
+ * Read a block as it is stored on disk, which is its network serialization
+ * with witness data, without deserializing it. The most recently read blocks
+ * are kept in memory.
+ */
+bool ReadRawBlockFromDisk(std::shared_ptr<const std::vector<unsigned char>>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Whether a serialized block holds witness data, so that its serialization without it differs. */
+bool RawBlockHasWitness(const std::vector<unsigned char>& block);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -425,6 +513,14 @@ public:
     bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
 };
 
+/**
+ * Verify the block and undo data of the last nCheckDepth blocks of the active
+ * chain, at check levels up to 2, without holding cs_main while reading and
+ * checking blocks. Meant to run on a background thread once the node is up.
+ * Returns early on shutdown, and shuts the node down if corruption is found.
+ */
+bool VerifyDBBackground(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth);
+
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
 
@@ -446,6 +542,9 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the view writing pcoinsTip flushes to the coins database in the background (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewAsyncFlush> pcoinsflushing;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -483,4 +582,13 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Write a snapshot of the block index, to be loaded on the next startup. Requires a flushed block index. */
+bool DumpBlockIndexSnapshot();
+
+/** Write the UTXO set at the chain tip to a snapshot file */
+bool DumpUTXOSnapshot(const fs::path& path, CValidationState& state, uint256& hashBlockRet, uint64_t& nCoinsRet);
+
+/** Load a snapshot written by DumpUTXOSnapshot into an empty, pruned chainstate and make its block the tip */
+bool LoadUTXOSnapshot(const fs::path& path, CValidationState& state, const CChainParams& chainparams, uint256& hashBlockRet, uint64_t& nCoinsRet);
+
 #endif // BITCOIN_VALIDATION_H
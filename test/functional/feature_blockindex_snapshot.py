@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test -blockindexsnapshot.
+
+- A node writes a block index snapshot on shutdown and loads it on restart.
+- A snapshot that the block index has moved on from is not used.
+- A corrupted snapshot is not used.
+"""
+import os
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+# Arbitrary regtest addresses, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+ADDRESS_FORK = 'mjTkW3DjgyZck4KbiRusZsqTgaYTxdSz6z'
+
+class BlockIndexSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+        self.extra_args = [["-blockindexsnapshot"]]
+
+    def debug_log_lines(self):
+        with open(os.path.join(self.nodes[0].datadir, "regtest", "debug.log"), encoding="utf-8") as f:
+            return f.read().splitlines()
+
+    def restart_and_check(self, extra_args, expected_log, while_stopped=None):
+        node = self.nodes[0]
+        tips = node.getchaintips()
+        best = node.getbestblockhash()
+        self.stop_node(0)
+        if while_stopped:
+            while_stopped()
+        nlines = len(self.debug_log_lines())
+        self.start_node(0, extra_args=extra_args)
+        assert any(expected_log in line for line in self.debug_log_lines()[nlines:])
+        assert_equal(node.getchaintips(), tips)
+        assert_equal(node.getbestblockhash(), best)
+
+    def run_test(self):
+        node = self.nodes[0]
+        snapshot_path = os.path.join(node.datadir, "regtest", "blockindex.dat")
+
+        self.log.info("Load the block index from a snapshot")
+        node.generatetoaddress(200, ADDRESS)
+        # Leave a stale tip in the block index too.
+        node.invalidateblock(node.getblockhash(190))
+        node.generatetoaddress(5, ADDRESS_FORK)
+        self.restart_and_check(["-blockindexsnapshot"], "Loading block index from snapshot")
+        assert os.path.exists(snapshot_path)
+
+        self.log.info("Do not use a snapshot of an older block index")
+        self.restart_and_check(["-blockindexsnapshot=0"], "Loading block index")
+        node.generatetoaddress(10, ADDRESS)
+        self.restart_and_check(["-blockindexsnapshot"], "loading block index from the database")
+        self.restart_and_check(["-blockindexsnapshot"], "Loading block index from snapshot")
+
+        self.log.info("Do not use a corrupted snapshot")
+        def corrupt_snapshot():
+            with open(snapshot_path, "r+b") as f:
+                f.seek(os.path.getsize(snapshot_path) // 2)
+                byte = f.read(1)
+                f.seek(-1, os.SEEK_CUR)
+                f.write(bytes([byte[0] ^ 0xff]))
+        self.restart_and_check(["-blockindexsnapshot"], "loading block index from the database", corrupt_snapshot)
+        self.restart_and_check(["-blockindexsnapshot"], "Loading block index from snapshot")
+
+if __name__ == '__main__':
+    BlockIndexSnapshotTest().main()
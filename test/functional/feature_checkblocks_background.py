@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test -checkblocksbackground.
+
+- By default, only the tip is verified at startup and the rest of -checkblocks
+  in the background.
+- With -checkblocksbackground=0, all of -checkblocks is verified at startup.
+- The background check stops at pruned blocks, and logs what it verified.
+"""
+import os
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+
+# Arbitrary regtest address, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+
+class CheckBlocksBackgroundTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def debug_log_lines(self):
+        with open(os.path.join(self.nodes[0].datadir, "regtest", "debug.log"), encoding="utf-8") as f:
+            return f.read().splitlines()
+
+    def restart(self, extra_args):
+        self.stop_node(0)
+        nlines = len(self.debug_log_lines())
+        self.start_node(0, extra_args=extra_args)
+        return nlines
+
+    def wait_for_log(self, nlines, expected_log, timeout=30):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if any(expected_log in line for line in self.debug_log_lines()[nlines:]):
+                return
+            time.sleep(0.1)
+        raise AssertionError("'%s' not found in debug.log" % expected_log)
+
+    def run_test(self):
+        self.nodes[0].generatetoaddress(200, ADDRESS)
+
+        self.log.info("Verify the tip at startup and the rest in the background")
+        nlines = self.restart(["-checkblocks=100", "-checklevel=4"])
+        assert any("Verifying last 1 blocks at level 4" in line for line in self.debug_log_lines()[nlines:])
+        self.wait_for_log(nlines, "Verifying last 100 blocks at level 2 in the background")
+        self.wait_for_log(nlines, "Background block verification done, no errors found in blocks 101 to 200")
+
+        self.log.info("Verify all blocks in the background with -checkblocks=0")
+        nlines = self.restart(["-checkblocks=0"])
+        self.wait_for_log(nlines, "Background block verification done, no errors found in blocks 1 to 200")
+
+        self.log.info("Verify everything at startup with -checkblocksbackground=0")
+        nlines = self.restart(["-checkblocks=100", "-checkblocksbackground=0"])
+        lines = self.debug_log_lines()[nlines:]
+        assert any("Verifying last 100 blocks at level 3" in line for line in lines)
+        assert not any("Background block verification" in line for line in lines)
+
+        self.log.info("Stop the background check at pruned blocks")
+        self.restart(["-prune=1", "-fastprune"])
+        self.nodes[0].generatetoaddress(900, ADDRESS)
+        self.nodes[0].pruneblockchain(800)
+        pruneheight = self.nodes[0].getblockchaininfo()["pruneheight"]
+        assert pruneheight > 1
+        nlines = self.restart(["-prune=1", "-fastprune", "-checkblocks=0"])
+        self.wait_for_log(nlines, "Background block verification stopped at height %d (pruning, no data), no errors found in the %d blocks %d to 1100" % (pruneheight - 1, 1101 - pruneheight, pruneheight))
+        assert not any("Background block verification done" in line for line in self.debug_log_lines()[nlines:])
+
+if __name__ == '__main__':
+    CheckBlocksBackgroundTest().main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test serving blocks to peers and over REST as they are stored on disk.
+
+- Blocks requested with and without witness data over P2P, including
+  repeated requests that are served from memory.
+- Blocks requested over REST in binary, hex and JSON format.
+"""
+import http.client
+import urllib.parse
+
+from test_framework.messages import CInv, MSG_WITNESS_FLAG
+from test_framework.mininode import P2PInterface, msg_getdata, network_thread_start
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, wait_until
+
+# Arbitrary regtest address, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+
+MSG_BLOCK = 2
+
+class BlockReceiver(P2PInterface):
+    def __init__(self):
+        super().__init__()
+        self.blocks = []
+
+    def on_block(self, message):
+        message.block.calc_sha256()
+        self.blocks.append(message.block)
+
+class RawBlocksTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+        self.extra_args = [["-rest"]]
+
+    def run_test(self):
+        node = self.nodes[0]
+        # Blocks mined on regtest have a witness commitment, and so a coinbase witness.
+        node.generatetoaddress(20, ADDRESS)
+
+        self.log.info("Serve blocks to peers")
+        peer = node.add_p2p_connection(BlockReceiver())
+        network_thread_start()
+        peer.wait_for_verack()
+        for height in [5, 10, 5]:
+            block_hash = node.getblockhash(height)
+            block_hex = node.getblock(block_hash, 0)
+            for inv_type in [MSG_BLOCK | MSG_WITNESS_FLAG, MSG_BLOCK]:
+                peer.send_message(msg_getdata([CInv(inv_type, int(block_hash, 16))]))
+                wait_until(lambda: len(peer.blocks) > 0, lock=None)
+                block = peer.blocks.pop()
+                assert_equal(block.hash, block_hash)
+                if inv_type & MSG_WITNESS_FLAG:
+                    assert_equal(block.serialize(with_witness=True).hex(), block_hex)
+                else:
+                    # The peer gets the block without its witness data.
+                    assert_equal(block.serialize(with_witness=True), block.serialize())
+                    assert block.serialize().hex() != block_hex
+
+        self.log.info("Serve blocks over REST")
+        url = urllib.parse.urlparse(node.url)
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        block_hash = node.getblockhash(7)
+        block_hex = node.getblock(block_hash, 0)
+        conn.request('GET', '/rest/block/%s.bin' % block_hash)
+        assert_equal(conn.getresponse().read().hex(), block_hex)
+        conn.request('GET', '/rest/block/%s.hex' % block_hash)
+        assert_equal(conn.getresponse().read().decode().strip(), block_hex)
+        conn.request('GET', '/rest/block/%s.json' % block_hash)
+        assert block_hash in conn.getresponse().read().decode()
+
+if __name__ == '__main__':
+    RawBlocksTest().main()
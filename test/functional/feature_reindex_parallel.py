@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test loading blocks from block files, which checks them on several threads.
+
+- Reindex a chain whose block file ends in garbage.
+- Reindex a block file with its blocks in reverse order, so that every block
+  but the genesis block comes before its parent, and with records that do not
+  hold a block in between.
+"""
+import os
+import struct
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, wait_until
+
+# Arbitrary regtest address, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+
+MAGIC = bytes.fromhex("fabfb5da")
+
+def record(data):
+    return MAGIC + struct.pack("<I", len(data)) + data
+
+class ReindexParallelTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # The nodes are not connected, node 1 only gets blocks from a file.
+        self.setup_nodes()
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generatetoaddress(300, ADDRESS)
+        tip = node.getbestblockhash()
+        height = node.getblockcount()
+
+        self.log.info("Reindex a block file that ends in garbage")
+        self.stop_node(0)
+        with open(os.path.join(node.datadir, "regtest", "blocks", "blk00000.dat"), "ab") as f:
+            f.write(record(b"\x00" * 100))
+            f.write(MAGIC + struct.pack("<I", 1000) + b"\xff" * 10)
+        self.start_node(0, extra_args=["-reindex"])
+        wait_until(lambda: node.getblockcount() == height)
+        assert_equal(node.getbestblockhash(), tip)
+
+        self.log.info("Reindex blocks in reverse order, between records without a block")
+        blocks = [bytes.fromhex(node.getblock(node.getblockhash(h), 0)) for h in range(height + 1)]
+        self.stop_node(1)
+        blocks_dir = os.path.join(self.nodes[1].datadir, "regtest", "blocks")
+        for name in os.listdir(blocks_dir):
+            if name.endswith(".dat"):
+                os.remove(os.path.join(blocks_dir, name))
+        with open(os.path.join(blocks_dir, "blk00000.dat"), "wb") as f:
+            for i, block in enumerate(reversed(blocks)):
+                # Records that do not deserialize as a block. Every third one
+                # claims to be larger than it is, so the blocks after it are
+                # only found by scanning on from inside it.
+                garbage = b"\xff" * 100
+                if i % 3 == 1:
+                    f.write(MAGIC + struct.pack("<I", 1000) + garbage)
+                else:
+                    f.write(record(garbage))
+                f.write(record(block))
+        self.start_node(1, extra_args=["-reindex"])
+        wait_until(lambda: self.nodes[1].getblockcount() == height)
+        assert_equal(self.nodes[1].getbestblockhash(), tip)
+
+if __name__ == '__main__':
+    ReindexParallelTest().main()
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test deep reorgs with and without blocks read ahead of disconnection.
+
+Two nodes, one reading blocks and undo data ahead (-blockreadahead) and one
+not, disconnect long chains of blocks and reorg between two forks. They must
+agree on the UTXO set, and end up with the one they started from.
+"""
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, sync_blocks
+
+# Arbitrary regtest addresses, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+ADDRESS_FORK = 'mjTkW3DjgyZck4KbiRusZsqTgaYTxdSz6z'
+
+class ReorgReadAheadTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-blockreadahead=16"], ["-blockreadahead=0"]]
+
+    def utxo_hashes(self):
+        return [node.gettxoutsetinfo()['hash_serialized_2'] for node in self.nodes]
+
+    def run_test(self):
+        self.log.info("Mine a chain of 150 blocks")
+        self.nodes[0].generatetoaddress(150, ADDRESS)
+        self.sync_all()
+        tip = self.nodes[0].getbestblockhash()
+        utxo_hash = self.utxo_hashes()[0]
+        fork_point = self.nodes[0].getblockhash(10)
+        first_block = self.nodes[0].getblockhash(11)
+
+        self.log.info("Disconnect 140 blocks")
+        for node in self.nodes:
+            node.invalidateblock(first_block)
+            assert_equal(node.getbestblockhash(), fork_point)
+        fork_utxo_hash = self.utxo_hashes()
+        assert_equal(fork_utxo_hash[0], fork_utxo_hash[1])
+
+        self.log.info("Mine a longer fork from height 10")
+        self.nodes[0].generatetoaddress(160, ADDRESS_FORK)
+        sync_blocks(self.nodes)
+        first_fork_block = self.nodes[0].getblockhash(11)
+        for node in self.nodes:
+            node.reconsiderblock(first_block)
+            assert_equal(node.getblockcount(), 170)
+
+        self.log.info("Reorg back to the original chain, disconnecting 160 blocks")
+        for node in self.nodes:
+            node.invalidateblock(first_fork_block)
+            assert_equal(node.getbestblockhash(), tip)
+        assert_equal(self.utxo_hashes(), [utxo_hash, utxo_hash])
+
+if __name__ == '__main__':
+    ReorgReadAheadTest().main()
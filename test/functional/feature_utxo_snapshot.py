@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the dumptxoutset and loadtxoutset RPCs.
+
+- node0 mines a chain and dumps its UTXO set.
+- node1 (not pruned) refuses to load the snapshot.
+- node2 (pruned) loads it, ends up with the same UTXO set and tip, then
+  syncs blocks mined on top of the snapshot and keeps its state on restart.
+- loading a second snapshot into node2 fails.
+"""
+import os
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+    sync_blocks,
+)
+
+# Arbitrary regtest address, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [[], [], ["-prune=550"]]
+
+    def setup_network(self):
+        # Keep the nodes apart so node2 does not sync the chain from node0.
+        self.setup_nodes()
+
+    def run_test(self):
+        node0, node1, node2 = self.nodes
+        node0.generatetoaddress(150, ADDRESS)
+
+        self.log.info("Dump the UTXO set of node0")
+        res = node0.dumptxoutset("utxo.dat")
+        path = os.path.join(node0.datadir, "regtest", "utxo.dat")
+        assert_equal(res["path"], path)
+        assert_equal(res["base_height"], 150)
+        assert_equal(res["base_hash"], node0.getbestblockhash())
+        txoutset = node0.gettxoutsetinfo()
+        assert_equal(res["coins_written"], txoutset["txouts"])
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, "utxo.dat")
+
+        self.log.info("Loading requires pruning")
+        assert_raises_rpc_error(-1, "requires pruning", node1.loadtxoutset, path)
+
+        self.log.info("Load the snapshot into pruned node2")
+        res = node2.loadtxoutset(path)
+        assert_equal(res["coins_loaded"], txoutset["txouts"])
+        assert_equal(res["base_height"], 150)
+        assert_equal(node2.getbestblockhash(), node0.getbestblockhash())
+        assert_equal(node2.gettxoutsetinfo()["hash_serialized_2"], txoutset["hash_serialized_2"])
+        assert_equal(node2.getblockchaininfo()["pruned"], True)
+        assert_raises_rpc_error(-1, "empty chainstate", node2.loadtxoutset, path)
+
+        self.log.info("Sync blocks on top of the snapshot")
+        connect_nodes(node2, 0)
+        node0.generatetoaddress(10, ADDRESS)
+        sync_blocks([node0, node2])
+        assert_equal(node2.gettxoutsetinfo()["hash_serialized_2"], node0.gettxoutsetinfo()["hash_serialized_2"])
+
+        self.log.info("Restart node2 and check that the chainstate persisted")
+        self.restart_node(2)
+        assert_equal(node2.getblockcount(), 160)
+        assert_equal(node2.gettxoutsetinfo()["hash_serialized_2"], node0.gettxoutsetinfo()["hash_serialized_2"])
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the scantxoutset RPC.
+
+Coinbase outputs are mined to the standard scripts of a few public keys, then
+looked up by address, by scriptPubKey and by public key.
+"""
+from decimal import Decimal
+
+from test_framework.address import key_to_p2pkh, key_to_p2sh_p2wpkh, key_to_p2wpkh
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error
+
+# Arbitrary regtest address, so the test does not need a wallet
+ADDRESS = 'mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ'
+
+# Public keys of the private keys 1 and 2, compressed, and of 1 uncompressed
+PUBKEY1 = '0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798'
+PUBKEY2 = '02c6047f9441ed7d6d3045406e95c07cd85c778e4b8cef3ca7abac09b95c709ee5'
+PUBKEY1_UNCOMPRESSED = '0479be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8'
+
+class ScanTxoutsetTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        self.log.info("Mine coinbase outputs to the scripts of a few keys")
+        addresses = [
+            key_to_p2pkh(PUBKEY1),
+            key_to_p2sh_p2wpkh(PUBKEY1),
+            key_to_p2wpkh(PUBKEY1),
+            key_to_p2pkh(PUBKEY1_UNCOMPRESSED),
+            key_to_p2pkh(PUBKEY2),
+        ]
+        for address in addresses:
+            node.generatetoaddress(1, address)
+        node.generatetoaddress(100, ADDRESS)
+        tip = node.getbestblockhash()
+
+        self.log.info("Scan for addresses")
+        result = node.scantxoutset("start", [addresses[0], {"address": addresses[4]}])
+        assert_equal(result['success'], True)
+        assert_equal(result['searched_items'], 105)
+        assert_equal(result['height'], 105)
+        assert_equal(result['bestblock'], tip)
+        assert_equal(result['total_amount'], Decimal('100'))
+        assert_equal(sorted(u['height'] for u in result['unspents']), [1, 5])
+        assert_equal(node.scantxoutset("start", [ADDRESS])['total_amount'], Decimal('5000'))
+
+        self.log.info("Scan for a scriptPubKey")
+        script = node.validateaddress(addresses[2])['scriptPubKey']
+        result = node.scantxoutset("start", [{"script": script}])
+        assert_equal(len(result['unspents']), 1)
+        assert_equal(result['unspents'][0]['scriptPubKey'], script)
+        assert_equal(result['unspents'][0]['height'], 3)
+        assert_equal(result['unspents'][0]['vout'], 0)
+        assert_equal(result['unspents'][0]['txid'], node.getblock(node.getblockhash(3))['tx'][0])
+
+        self.log.info("Scan for public keys")
+        result = node.scantxoutset("start", [{"pubkey": PUBKEY1}])
+        assert_equal(sorted(u['height'] for u in result['unspents']), [1, 2, 3])
+        result = node.scantxoutset("start", [{"pubkey": PUBKEY1_UNCOMPRESSED}])
+        assert_equal(sorted(u['height'] for u in result['unspents']), [4])
+        assert_equal(node.scantxoutset("start", [{"pubkey": PUBKEY1}, {"pubkey": PUBKEY2}])['total_amount'], Decimal('200'))
+
+        self.log.info("Scripts without unspent outputs are not found")
+        assert_equal(node.scantxoutset("start", [key_to_p2wpkh(PUBKEY2)])['unspents'], [])
+
+        self.log.info("Invalid scan objects are rejected")
+        assert_raises_rpc_error(-5, "Invalid address", node.scantxoutset, "start", ["notanaddress"])
+        assert_raises_rpc_error(-8, "Script must be hexadecimal", node.scantxoutset, "start", [{"script": "zz"}])
+        assert_raises_rpc_error(-5, "Invalid public key", node.scantxoutset, "start", [{"pubkey": "02"}])
+        assert_raises_rpc_error(-8, "Invalid scan object", node.scantxoutset, "start", [{"xpub": "x"}])
+        assert_raises_rpc_error(-8, "scanobjects argument is required", node.scantxoutset, "start")
+        assert_raises_rpc_error(-8, "Invalid command", node.scantxoutset, "resume", [])
+
+        self.log.info("Status and abort without a scan in progress")
+        assert_equal(node.scantxoutset("status"), None)
+        assert_equal(node.scantxoutset("abort"), False)
+
+if __name__ == '__main__':
+    ScanTxoutsetTest().main()
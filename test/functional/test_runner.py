@@ -80,6 +80,8 @@ BASE_SCRIPTS= [
     'rpc_rawtransaction.py',
     'wallet_address_types.py',
     'feature_reindex.py',
+    'feature_reindex_parallel.py',
+    'feature_raw_blocks.py',
     # vv Tests less than 30s vv
     'wallet_keypool_topup.py',
     'interface_zmq.py',
@@ -112,6 +114,11 @@ BASE_SCRIPTS= [
     'p2p_invalid_tx.py',
     'feature_versionbits_warning.py',
     'rpc_preciousblock.py',
+    'feature_utxo_snapshot.py',
+    'rpc_scantxoutset.py',
+    'feature_blockindex_snapshot.py',
+    'feature_reorg_readahead.py',
+    'feature_checkblocks_background.py',
     'wallet_importprunedfunds.py',
     'rpc_signmessage.py',
     'feature_nulldummy.py',